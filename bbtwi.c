@@ -0,0 +1,193 @@
+/* $Id: bbtwi.c $
+ * Functions for bitbanging I2C over two pins of the AVR,
+ * which mostly come from the old NTP LED clock project.
+ * All sensors share this bus, and are powered through two other pins
+ * of the same port.
+ */
+
+#include <avr/io.h>
+#include <inttypes.h>
+#include <util/delay.h>
+#include "bbtwi.h"
+
+/* The Port used for the connection */
+#define BBTWIPORT PORTD
+#define BBTWIPIN PIND
+#define BBTWIDDR DDRD
+
+/* Which pins of the port */
+#define PWRPIN PD4
+#define SDAPIN PD5
+#define SCLPIN PD6
+#define GNDPIN PD7
+
+/* FIXME */
+#define DELAYVAL 14
+
+void bbtwi_init(void)
+{
+  /* We abuse two I/O ports to provide Power to the sensors */
+  BBTWIPORT &= (uint8_t)~_BV(GNDPIN);
+  BBTWIDDR |= _BV(GNDPIN);
+  BBTWIPORT |= _BV(PWRPIN);
+  BBTWIDDR |= _BV(PWRPIN);
+  /* Initialize I2C bus: Enable pullups. */
+  BBTWIPORT |= _BV(SCLPIN);
+  BBTWIPORT |= _BV(SDAPIN);
+}
+
+void bbtwi_power(uint8_t on)
+{
+  if (on) {
+    BBTWIPORT |= _BV(PWRPIN);
+    /* Enable pullups again */
+    BBTWIPORT |= _BV(SCLPIN);
+    BBTWIPORT |= _BV(SDAPIN);
+  } else {
+    /* Tristate the bus and disable the pullups first, else the sensors
+     * would be powered through them. */
+    BBTWIDDR &= (uint8_t)~(_BV(SDAPIN) | _BV(SCLPIN));
+    BBTWIPORT &= (uint8_t)~(_BV(SDAPIN) | _BV(SCLPIN));
+    BBTWIPORT &= (uint8_t)~_BV(PWRPIN);
+  }
+}
+
+/* A slave can get stuck in the middle of sending a byte, e.g. when we
+ * were reset during a transfer. It then holds SDA low and waits for
+ * clocks. Up to 9 clocks (8 data bits and the ACK) get it to the end of
+ * its byte, where it lets go of SDA, and the STOP resets its state.
+ * Returns with SDA and SCL high. */
+void bbtwi_busclear(void)
+{
+  uint8_t i;
+  /* Let go of SDA, we only want to drive SCL. */
+  BBTWIPORT |= _BV(SDAPIN);
+  BBTWIDDR &= (uint8_t)~_BV(SDAPIN);
+  BBTWIPORT |= _BV(SCLPIN);
+  BBTWIDDR |= _BV(SCLPIN);
+  for (i = 0; i < 9; i++) {
+    BBTWIPORT &= (uint8_t)~_BV(SCLPIN);
+    _delay_loop_1(DELAYVAL);
+    BBTWIPORT |= _BV(SCLPIN);
+    _delay_loop_1(DELAYVAL);
+  }
+  /* Now send a STOP: Take SCL and SDA low, bbtwi_stop does the rest. */
+  BBTWIPORT &= (uint8_t)~_BV(SCLPIN);
+  _delay_loop_1(DELAYVAL);
+  BBTWIPORT &= (uint8_t)~_BV(SDAPIN);
+  BBTWIDDR |= _BV(SDAPIN);
+  _delay_loop_1(DELAYVAL);
+  bbtwi_stop();
+}
+
+/* Send START, defined as high-to-low SDA with SCL high.
+ * Expects SCL and SDA to be high already (pullups on)!
+ * Returns with SDA and SCL actively pulled low. */
+void bbtwi_start(void) {
+  /* Change to output mode. */
+  BBTWIDDR |= _BV(SDAPIN);
+  BBTWIDDR |= _BV(SCLPIN);
+  /* change SDA to low */
+  BBTWIPORT &= (uint8_t)~_BV(SDAPIN);
+  _delay_loop_1(DELAYVAL);
+  /* and SCL too */
+  BBTWIPORT &= (uint8_t)~_BV(SCLPIN);
+  _delay_loop_1(DELAYVAL);
+}
+
+/* Send STOP, defined as low-to-high SDA with SCL high.
+ * Expects SCL and SDA to be low already!
+ * Returns with SDA and SCL high. */
+void bbtwi_stop(void) {
+  /* Set SCL */
+  BBTWIPORT |= _BV(SCLPIN);
+  _delay_loop_1(DELAYVAL);
+  /* Set SDA */
+  BBTWIPORT |= _BV(SDAPIN);
+  _delay_loop_1(DELAYVAL);
+  /* Probably safer to tristate the bus */
+  BBTWIDDR &= (uint8_t)~_BV(SDAPIN);
+  BBTWIDDR &= (uint8_t)~_BV(SCLPIN);
+}
+
+/* Transmits the byte in what.
+ * Returns 1 if the byte was ACKed, 0 if not.
+ * Expects SCL to be driven low and SDA to be driven whatever way already!
+ * Returns with SCL and SDA driven low. */
+uint8_t bbtwi_transmit_byte(uint8_t what) {
+  uint8_t i;
+  for (i = 0; i < 8; i++) {
+    /* First put data on the bus */
+    if (what & 0x80) {
+      BBTWIPORT |= _BV(SDAPIN);
+    }
+    _delay_loop_1(DELAYVAL);
+    /* Then set SCL high */
+    BBTWIPORT |= _BV(SCLPIN);
+    _delay_loop_1(DELAYVAL);
+    /* Take SCL back */
+    BBTWIPORT &= (uint8_t)~_BV(SCLPIN);
+    _delay_loop_1(DELAYVAL);
+    /* And SDA too */
+    BBTWIPORT &= (uint8_t)~_BV(SDAPIN);
+    _delay_loop_1(DELAYVAL);
+    what <<= 1;
+  }
+  /* OK that was the data, now we read back the ACK */
+  /* We need to tristate SDA for that */
+  BBTWIPORT |= _BV(SDAPIN);
+  BBTWIDDR &= (uint8_t)~_BV(SDAPIN);
+  /* Give the device some time */
+  _delay_loop_1(DELAYVAL);
+  /* Then set SCL high */
+  BBTWIPORT |= _BV(SCLPIN);
+  _delay_loop_1(DELAYVAL);
+  i = BBTWIPIN & _BV(SDAPIN); /* Read ACK */
+  /* Take SCL back */
+  BBTWIPORT &= (uint8_t)~_BV(SCLPIN);
+  _delay_loop_1(DELAYVAL);
+  /* No more tristate, we pull SDA again */
+  BBTWIPORT &= (uint8_t)~_BV(SDAPIN);
+  BBTWIDDR |= _BV(SDAPIN);
+  _delay_loop_1(DELAYVAL);
+  return (i == 0);
+}
+
+/* Reads a byte from the bus and returns it.
+ * expects to start with SCL actively driven low.
+ */
+uint8_t bbtwi_read_byte(uint8_t sendack)
+{
+  uint8_t res = 0;
+  uint8_t i;
+  /* Make sure SDA is pulled up high but not actively driven */
+  BBTWIPORT |= _BV(SDAPIN);
+  BBTWIDDR &= (uint8_t)~_BV(SDAPIN);
+  for (i = 0; i < 8; i++) {
+    /* Raise the clock line */
+    BBTWIPORT |= _BV(SCLPIN);
+    /* Wait for the slave to pull the data line */
+    _delay_loop_1(DELAYVAL);
+    res <<= 1;
+    if (BBTWIPIN & _BV(SDAPIN)) {
+      res |= 0x01;
+    }
+    BBTWIPORT &= (uint8_t)~_BV(SCLPIN);
+    _delay_loop_1(DELAYVAL);
+  }
+  if (sendack) {
+    /* Alrighty then, we should send an ACK: drive low SDA. */
+    BBTWIPORT &= (uint8_t)~_BV(SDAPIN);
+  }
+  BBTWIDDR |= _BV(SDAPIN);
+  _delay_loop_1(DELAYVAL);
+  BBTWIPORT |= _BV(SCLPIN);
+  /* Wait for the slave to pull the data line */
+  _delay_loop_1(DELAYVAL);
+  BBTWIPORT &= (uint8_t)~_BV(SCLPIN);
+  _delay_loop_1(DELAYVAL);
+  BBTWIPORT |= _BV(SDAPIN);
+  BBTWIDDR &= (uint8_t)~_BV(SDAPIN);
+  _delay_loop_1(DELAYVAL);
+  return res;
+}
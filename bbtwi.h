@@ -0,0 +1,37 @@
+/* $Id: bbtwi.h $
+ * Functions for bitbanging I2C over two pins of the AVR.
+ * All sensors share this bus.
+ */
+
+#ifndef _BBTWI_H_
+#define _BBTWI_H_
+
+#define I2C_READ  0x01
+#define I2C_WRITE 0x00
+
+/* Power up the sensors and initialize the bus. */
+void bbtwi_init(void);
+
+/* Turn the power to the sensors on or off. While off, the bus lines are
+ * tristated without pullups, so the sensors are not powered through them. */
+void bbtwi_power(uint8_t on);
+
+/* Try to free a bus that is stuck because a slave is holding SDA low:
+ * Clock out 9 pulses on SCL, then send a STOP. */
+void bbtwi_busclear(void);
+
+/* Send START. Expects SCL and SDA to be high already (pullups on)!
+ * Returns with SDA and SCL actively pulled low. */
+void bbtwi_start(void);
+
+/* Send STOP. Expects SCL and SDA to be low already!
+ * Returns with SDA and SCL high. */
+void bbtwi_stop(void);
+
+/* Transmits the byte in what. Returns 1 if the byte was ACKed, 0 if not. */
+uint8_t bbtwi_transmit_byte(uint8_t what);
+
+/* Reads a byte from the bus and returns it. */
+uint8_t bbtwi_read_byte(uint8_t sendack);
+
+#endif /* _BBTWI_H_ */
@@ -0,0 +1,36 @@
+/* $Id: bh1750.c $
+ * Functions for reading the BH1750 ambient light sensor
+ *
+ * The I2C functions used live in bbtwi.c.
+ */
+
+#include <avr/io.h>
+#include <inttypes.h>
+#include "bbtwi.h"
+#include "bh1750.h"
+
+/* One time measurement, high resolution (1 lx), max. 180 ms.
+ * The sensor goes back to power down mode by itself afterwards. */
+#define BH1750_CMD_ONETIME_HIGH 0x20
+
+void bh1750_startmeas(uint8_t addr)
+{
+  bbtwi_start();
+  bbtwi_transmit_byte((addr << 1) | I2C_WRITE);
+  bbtwi_transmit_byte(BH1750_CMD_ONETIME_HIGH);
+  bbtwi_stop();
+}
+
+uint8_t bh1750_read(uint8_t addr, uint16_t * raw)
+{
+  bbtwi_start();
+  if (!bbtwi_transmit_byte((addr << 1) | I2C_READ)) {
+    bbtwi_stop();
+    return 0;
+  }
+  uint8_t b1 = bbtwi_read_byte(1);  /* MSB */
+  uint8_t b2 = bbtwi_read_byte(0);  /* LSB */
+  bbtwi_stop();
+  *raw = (b1 << 8) | b2;
+  return 1;
+}
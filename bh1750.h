@@ -0,0 +1,20 @@
+/* $Id: bh1750.h $
+ * Functions for reading the BH1750 ambient light sensor
+ */
+
+#ifndef _BH1750_H_
+#define _BH1750_H_
+
+/* The I2C addresses the BH1750 can have (ADDR pin low / high) */
+#define BH1750_ADDR_L 0x23
+#define BH1750_ADDR_H 0x5C
+
+/* Start a single measurement. The sensor powers down by itself afterwards. */
+void bh1750_startmeas(uint8_t addr);
+
+/* Read result of measurement. Needs to be called no earlier than 180 ms
+ * after starting. Returns 1 on success. The raw value divided by 1.2 is
+ * the illuminance in lux. */
+uint8_t bh1750_read(uint8_t addr, uint16_t * raw);
+
+#endif /* _BH1750_H_ */
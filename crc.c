@@ -0,0 +1,25 @@
+/* $Id: crc.c $
+ * CRC used by the over-the-air protocol (LaCrosse / CustomSensor frames).
+ * This is shared between the sensor and the gateway firmware.
+ */
+
+#include <inttypes.h>
+#include "crc.h"
+
+uint8_t calculatecrc(uint8_t * data, uint8_t len)
+{
+  uint8_t i, j;
+  uint8_t res = 0;
+  for (j = 0; j < len; j++) {
+    uint8_t val = data[j];
+    for (i = 0; i < 8; i++) {
+      uint8_t tmp = (uint8_t)((res ^ val) & 0x80);
+      res <<= 1;
+      if (0 != tmp) {
+        res ^= 0x31;
+      }
+      val <<= 1;
+    }
+  }
+  return res;
+}
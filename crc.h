@@ -0,0 +1,11 @@
+/* $Id: crc.h $
+ * CRC used by the over-the-air protocol (LaCrosse / CustomSensor frames)
+ */
+
+#ifndef _CRC_H_
+#define _CRC_H_
+
+/* Calculates the CRC8 (polynomial 0x31, start value 0) over len bytes. */
+uint8_t calculatecrc(uint8_t * data, uint8_t len);
+
+#endif /* _CRC_H_ */
@@ -9,6 +9,33 @@
 
 /* The SensorID */
 #define THESENSORID 17
-/* Do not set these directly, set the define above */
-EEMEM uint8_t ee_sensorid = THESENSORID;
-EEMEM uint8_t ee_invsensorid = THESENSORID ^ 0xff;
+/* Transmit interval in multiples of 8 seconds. The firmware adds 0 or 1
+ * at random to that. */
+#define THETXINTERVAL 3
+/* Open a window for over-the-air config updates after every n-th
+ * transmission (only if compiled with OTACONFIG), 0 = never. */
+#define THERXEVERY 64
+/* Radio profile, see rfm69_setprofile(). 0xff = keep the compiled in
+ * RFM_DATARATE */
+#define THERADIOPROFILE 0xff
+/* Key for authenticating config updates. All 0xff disables them. */
+#define THEOTAKEY { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, \
+                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }
+/* Do not set these directly, set the defines above */
+EEMEM struct eesettings ee = {
+  .invsensorid = THESENSORID ^ 0xff,
+  .sensorid = THESENSORID,
+  .txinterval = THETXINTERVAL,
+  .invtxinterval = THETXINTERVAL ^ 0xff,
+  .rxevery = THERXEVERY,
+  .invrxevery = THERXEVERY ^ 0xff,
+  .radioprofile = THERADIOPROFILE,
+  .invradioprofile = THERADIOPROFILE ^ 0xff,
+  .tempoffset = 0,
+  .invtempoffset = 0xffff,
+  .humoffset = 0,
+  .invhumoffset = 0xffff,
+  .otakey = THEOTAKEY,
+  .otaseq = 0,
+  .invotaseq = 0xffff
+};
@@ -7,7 +7,33 @@
 #ifndef _EEPROM_H_
 #define _EEPROM_H_
 
-extern EEMEM uint8_t ee_sensorid;
-extern EEMEM uint8_t ee_invsensorid; /* This is used as a sort of "CRC" */
+/* Everything is in one struct, so the layout does not depend on the order
+ * in which the compiler places variables (avr-gcc places separate EEMEM
+ * variables in reverse order). The first two bytes are where every
+ * firmware before had the sensor ID, so old EEPROM images stay valid. */
+struct eesettings {
+  uint8_t invsensorid; /* This is used as a sort of "CRC" */
+  uint8_t sensorid;
+  /* Further settings, all with an inverted copy like the sensor ID */
+  uint8_t txinterval; /* in multiples of 8 seconds */
+  uint8_t invtxinterval;
+  uint8_t rxevery; /* Open a config RX window every n-th TX */
+  uint8_t invrxevery;
+  uint8_t radioprofile; /* see rfm69_setprofile() */
+  uint8_t invradioprofile;
+  /* Calibration offsets, signed, in raw sensor units */
+  uint16_t tempoffset;
+  uint16_t invtempoffset;
+  uint16_t humoffset;
+  uint16_t invhumoffset;
+  /* Key for authenticating over-the-air config updates. All 0xff = none,
+   * which disables them. */
+  uint8_t otakey[16];
+  /* Sequence number of the last accepted config update */
+  uint16_t otaseq;
+  uint16_t invotaseq;
+};
+
+extern EEMEM struct eesettings ee;
 
 #endif /* _EEPROM_H_ */
@@ -0,0 +1,59 @@
+/* $Id: frame.h $
+ * The frames the sensor sends. The protocol we use is that of a
+ * "CustomSensor" from the FHEM LaCrosseItPlusReader sketch for the
+ * Jeelink:
+ *
+ * Byte  0: Startbyte (=0xCC)
+ * Byte  1: Sensor-ID (0 - 255/0xff)
+ * Byte  2: Number of data bytes that follow (6 + n, CRC not counted)
+ * Byte  3: Sensortype (=0xf7 for FoxTemp)
+ * Byte  4: temperature MSB (raw value from SHT4x)
+ * Byte  5: temperature LSB
+ * Byte  6: humidity MSB (raw value from SHT4x)
+ * Byte  7: humidity LSB
+ * Byte  8: Battery voltage
+ * Byte  9: only if n > 0: what else the frame contains, a FRAME_EXT_*
+ *          bitmask
+ * Byte 10 to 9+n-1: the data announced in byte 9, in the order of the
+ *          bits, lowest first, all values MSB first
+ * Byte  9+n: CRC
+ *
+ * Without anything announced in byte 9, n is 0 and the frame is exactly
+ * what a foxtemp2016 sends.
+ */
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+/* Length of a frame without byte 9 and what follows, CRC included */
+#define FRAME_CLASSICLEN 10
+
+/* 4 bytes: raw temperature and humidity of a second SHT4x */
+#define FRAME_EXT_SHT4X_B 0x01
+/* 2 bytes: raw value of a BH1750, lux = value / 1.2 */
+#define FRAME_EXT_BH1750  0x02
+/* Diagnostic counters of the sensor (only with -DDIAGSTATS, and only in
+ * some frames): 1 byte with the number of bytes that follow, then 16 bit
+ * counters, MSB first. Older firmware may send fewer, newer firmware
+ * more, so a receiver has to go by that length. Counters wrap around,
+ * only the differences between two frames are meaningful.
+ *  0: resets forced because the sensor could not be read (survives the
+ *     reset, not a power loss)
+ *  1: sensor recovery: measurement restarted
+ *  2: sensor recovery: I2C bus cleared
+ *  3: sensor recovery: sensors power cycled
+ *  4: sensor recovery: nothing helped
+ *  5: listen before talk: channel found busy (0 without RFM_LBT)
+ *  6: listen before talk: sent although the channel stayed busy
+ *  7: config over the air: windows opened (0 without OTACONFIG)
+ *  8: config over the air: updates accepted
+ *  9: config over the air: updates rejected (bad MAC or old sequence)
+ * 10: config over the air: checks of the radio while listening, each
+ *     about 1.2 ms with the receiver on */
+#define FRAME_EXT_DIAG    0x40
+#define FRAME_DIAG_COUNTERS 11
+/* No data: the sensor listens for a config frame right after this one
+ * (see ota.h). The gateway only sends config frames after these. */
+#define FRAME_EXT_RXWINDOW 0x80
+
+#endif /* _FRAME_H_ */
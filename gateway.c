@@ -0,0 +1,341 @@
+/* $Id: gateway.c $
+ * main for the FoxTemp 2022 gateway: This turns a Canique MK2 (or Moteino)
+ * into a receiver for the frames sent by foxtemp2016 / foxtemp2022 devices,
+ * replacing a JeeLink with the LaCrosseItPlusReader sketch.
+ *
+ * The RFM69 runs in continuous RX. Whenever it has a complete frame, it
+ * raises DIO0 (PayloadReady), which is connected to INT0. The interrupt
+ * handler drains the FIFO right away, so the radio can restart its
+ * receiver for the next frame. The main loop then checks the frames and
+ * streams them out the USART in a compact binary format:
+ *
+ * Byte  0: Startbyte (=0xA5)
+ * Byte  1: Type ('F' = frame, 'S' = statistics)
+ * Byte  2: Number of payload bytes that follow (n)
+ * Byte  3 to 3+n-1: payload
+ * Byte  3+n: Checksum, XOR over bytes 1 to 3+n-1
+ *
+ * Payload of type 'F': the received frame (see frame.h, its length
+ *   follows from its byte 2) followed by the raw RSSI (signal strength in
+ *   dBm is -RSSI / 2).
+ * Payload of type 'S': three 32 bit counters, MSB first: valid frames,
+ *   invalid frames (wrong startbyte or CRC), frames dropped because our
+ *   buffer was full.
+ *
+ * Payload of type 'T': Sensor-ID and sequence number (bytes 1 to 3) of
+ *   a config frame we just sent.
+ *
+ * In the other direction, the host can send a record of type 'D' in the
+ * same format, containing a config frame for over-the-air configuration
+ * (see ota.h). We then send that config frame right after every frame
+ * we receive from the sensor it is for (or from any sensor, if it is for
+ * all of them) that announces a receive window (FRAME_EXT_RXWINDOW, see
+ * frame.h), until the host sends an empty 'D' record or a new one.
+ * The sensors only listen after every n-th transmission and ignore
+ * updates they already have, so repeating it is both needed and harmless,
+ * and we do not waste airtime on frames after which nobody listens.
+ *
+ * Use hostgateway to decode this on the host.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+
+#include "crc.h"
+#include "frame.h"
+#include "ota.h"
+#include "rfm69.h"
+
+/* We need to disable the watchdog very early, because it stays active
+ * after a reset with a timeout of only 15 ms. */
+void dwdtonreset(void) __attribute__((naked)) __attribute__((section(".init3")));
+void dwdtonreset(void) {
+  MCUSR = 0;
+  wdt_disable();
+}
+
+/* Length of the longest frame we receive. Plain foxtemp2016/2022 frames
+ * are 10 bytes, additional sensors make them longer (see frame.h). The
+ * default also takes the 11 byte frames that announce a receive window
+ * for configuration over the air.
+ * The RFM69 cannot find out the length of our frames by itself (that
+ * would need the length right after the sync word), so it always receives
+ * this many bytes, and we take the real length from byte 2 of the frame.
+ * After a shorter frame, the receiver is thus busy with noise for a
+ * moment, about 0.5 ms per byte at 17241 baud, and misses anything that
+ * starts during that time. So this should not be larger than needed. */
+#ifndef GW_MAXFRAMELEN
+#define GW_MAXFRAMELEN (FRAME_CLASSICLEN + 1)
+#endif /* GW_MAXFRAMELEN not defined externally */
+
+/* Baudrate for the USART. We run with U2X, so this needs to be a value
+ * that F_CPU / 8 can be divided by without much error. At 16 MHz,
+ * 500000 and 1000000 are exact. */
+#ifndef GW_BAUDRATE
+#define GW_BAUDRATE 500000UL
+#endif /* GW_BAUDRATE not defined externally */
+
+/* Time in ms between receiving a frame and sending a config frame to
+ * that sensor. The sensor needs a few ms to turn on its receiver. */
+#define GW_TURNAROUND 10
+
+/* Send statistics after this many valid frames. */
+#define GW_STATSEVERY 100
+
+/* How many received frames we can buffer. Must be a power of 2. */
+#define RXRINGSIZE 16
+/* Size of the USART transmit buffer. Must be a power of 2. */
+#define TXRINGSIZE 256
+
+/* The received frame. It is sent out followed by the RSSI, for which we
+ * keep one byte of space after the longest possible frame. */
+struct rxframe {
+  uint8_t data[GW_MAXFRAMELEN + 1];
+  uint8_t rssi;
+};
+
+static struct rxframe rxring[RXRINGSIZE];
+static volatile uint8_t rxhead = 0;
+static volatile uint8_t rxtail = 0;
+
+static uint8_t txring[TXRINGSIZE];
+static volatile uint8_t txhead = 0;
+static volatile uint8_t txtail = 0;
+
+/* The config frame to send, see ota.h */
+static uint8_t downlink[OTA_FRAMELEN];
+static volatile uint8_t downlinkvalid = 0;
+/* Record from the host currently being received */
+static uint8_t hostrec[OTA_FRAMELEN + 4];
+static uint8_t hostrecpos = 0;
+
+/* Statistics */
+static uint32_t framesok = 0;
+static uint32_t framesbad = 0;
+static volatile uint32_t framesdropped = 0;
+
+/* Fetch a frame from the RFM69. This is called from the interrupt handler,
+ * and from the main loop with interrupts disabled. */
+static void drainfifo(void)
+{
+  uint8_t nh = (rxhead + 1) & (RXRINGSIZE - 1);
+  if (nh == rxtail) { /* No space left. We still need to empty the FIFO. */
+    uint8_t dummy[GW_MAXFRAMELEN];
+    rfm69_readfifo(dummy, GW_MAXFRAMELEN);
+    framesdropped++;
+    return;
+  }
+  /* Read RSSI first, it is still that of the frame we just received. */
+  rxring[rxhead].rssi = rfm69_readrssi();
+  rfm69_readfifo(rxring[rxhead].data, GW_MAXFRAMELEN);
+  rxhead = nh;
+}
+
+/* DIO0 of the RFM69: PayloadReady */
+ISR(INT0_vect)
+{
+  drainfifo();
+}
+
+/* USART data register empty: send next byte from our buffer */
+ISR(USART_UDRE_vect)
+{
+  if (txhead == txtail) { /* Nothing left to send */
+    UCSR0B &= (uint8_t)~_BV(UDRIE0);
+    return;
+  }
+  UDR0 = txring[txtail];
+  txtail = (txtail + 1) & (TXRINGSIZE - 1);
+}
+
+/* USART receive: collect records from the host. */
+ISR(USART_RX_vect)
+{
+  uint8_t b = UDR0;
+  if ((hostrecpos == 0) && (b != 0xA5)) {
+    return; /* Wait for startbyte */
+  }
+  hostrec[hostrecpos++] = b;
+  if ((hostrecpos == 3) && ((hostrec[1] != 'D')
+                         || ((hostrec[2] != 0) && (hostrec[2] != OTA_FRAMELEN)))) {
+    hostrecpos = 0; /* Nothing we know */
+    return;
+  }
+  if ((hostrecpos < 4) || (hostrecpos < (hostrec[2] + 4))) {
+    return; /* Not complete yet */
+  }
+  uint8_t chk = 0;
+  uint8_t i;
+  for (i = 1; i < hostrecpos - 1; i++) {
+    chk ^= hostrec[i];
+  }
+  if (chk == hostrec[hostrecpos - 1]) {
+    if (hostrec[2] == 0) {
+      downlinkvalid = 0;
+    } else {
+      for (i = 0; i < OTA_FRAMELEN; i++) {
+        downlink[i] = hostrec[3 + i];
+      }
+      downlinkvalid = 1;
+    }
+  }
+  hostrecpos = 0;
+}
+
+static void usart_init(void)
+{
+  UBRR0 = (F_CPU / 8 / GW_BAUDRATE) - 1;
+  UCSR0A = _BV(U2X0);
+  /* 8N1 */
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+  UCSR0B = _BV(TXEN0) | _BV(RXEN0) | _BV(RXCIE0);
+}
+
+/* Returns how many bytes are free in the transmit buffer. */
+static uint8_t usart_txfree(void)
+{
+  return (uint8_t)(txtail - txhead - 1) & (TXRINGSIZE - 1);
+}
+
+/* Queues a byte for sending. The caller has to make sure there is space. */
+static void usart_queue(uint8_t b)
+{
+  txring[txhead] = b;
+  txhead = (txhead + 1) & (TXRINGSIZE - 1);
+}
+
+static void sendrecord(uint8_t type, uint8_t * data, uint8_t len)
+{
+  uint8_t chk = type ^ len;
+  uint8_t i;
+  /* Wait for enough space in the buffer. At 500 kBaud this takes far less
+   * time than it takes to receive the next frame over the air. */
+  while (usart_txfree() < (len + 4)) { }
+  usart_queue(0xA5);
+  usart_queue(type);
+  usart_queue(len);
+  for (i = 0; i < len; i++) {
+    usart_queue(data[i]);
+    chk ^= data[i];
+  }
+  usart_queue(chk);
+  UCSR0B |= _BV(UDRIE0);
+}
+
+static void putu32(uint8_t * p, uint32_t v)
+{
+  p[0] = (v >> 24) & 0xff;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >>  8) & 0xff;
+  p[3] = (v >>  0) & 0xff;
+}
+
+static void sendstats(void)
+{
+  uint8_t buf[12];
+  putu32(&buf[0], framesok);
+  putu32(&buf[4], framesbad);
+  cli();
+  putu32(&buf[8], framesdropped);
+  sei();
+  sendrecord('S', buf, 12);
+}
+
+/* Sends the pending config frame, then goes back to receiving. */
+static void senddownlink(void)
+{
+  uint8_t buf[OTA_FRAMELEN];
+  uint8_t i;
+  cli();
+  for (i = 0; i < OTA_FRAMELEN; i++) {
+    buf[i] = downlink[i];
+  }
+  sei();
+  /* Do not let INT0 interfere, DIO0 means something else while sending */
+  EIMSK = 0;
+  rfm69_setreceiver(0);
+  _delay_ms(GW_TURNAROUND);
+  rfm69_sendarray(buf, OTA_FRAMELEN);
+  rfm69_initreceiver(GW_MAXFRAMELEN); /* sendarray changed the length */
+  rfm69_setreceiver(1);
+  EIFR = _BV(INTF0);
+  EIMSK = _BV(INT0);
+  sendrecord('T', &buf[1], 3);
+}
+
+int main(void)
+{
+  /* Unlike the sensor, we do not clock down: The gateway is powered
+   * through USB, and we need the speed to keep up. */
+  _delay_ms(100); /* The RFM69 needs some time to start up */
+
+  usart_init();
+  rfm69_initport();
+  rfm69_initchip();
+  rfm69_initreceiver(GW_MAXFRAMELEN);
+
+  /* PD2 is the IRQ line from the RFM69 (DIO0). Input without pullup,
+   * trigger INT0 on the rising edge. */
+  PORTD &= (uint8_t)~_BV(PD2);
+  DDRD &= (uint8_t)~_BV(PD2);
+  EICRA = _BV(ISC01) | _BV(ISC00);
+  EIFR = _BV(INTF0);
+  EIMSK = _BV(INT0);
+
+  /* there is a LED connected to PB1. We toggle it for every valid frame. */
+  PORTB &= (uint8_t)~_BV(PB1);
+  DDRB |= _BV(PB1);
+
+  rfm69_setreceiver(1);
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  /* All set up, enable interrupts and go. */
+  sei();
+  sendstats();
+
+  while (1) { /* Main loop, we should never exit it. */
+    cli();
+    /* If we somehow missed the edge on DIO0, the radio would wait forever
+     * for us to empty its FIFO. */
+    if (PIND & _BV(PD2)) {
+      drainfifo();
+      EIFR = _BV(INTF0); /* Do not let the ISR fetch the same frame again */
+    }
+    if (rxhead == rxtail) {
+      /* Nothing to do, sleep until the next interrupt. sei() only takes
+       * effect after the following instruction, so no interrupt can sneak
+       * in between. */
+      sleep_enable();
+      sei();
+      sleep_cpu();
+      sleep_disable();
+      continue;
+    }
+    sei();
+    struct rxframe * f = &rxring[rxtail];
+    /* The RFM69 only hands us frames with the right sync word, we check
+     * the rest. len is the length of the frame including its CRC. */
+    uint8_t len = f->data[2] + 4;
+    if ((f->data[0] == 0xCC)
+     && (f->data[2] >= (FRAME_CLASSICLEN - 4)) && (f->data[2] <= (GW_MAXFRAMELEN - 4))
+     && (calculatecrc(f->data, len - 1) == f->data[len - 1])) {
+      framesok++;
+      PORTB ^= _BV(PB1);
+      f->data[len] = f->rssi;
+      sendrecord('F', f->data, len + 1);
+      if (downlinkvalid && (len > FRAME_CLASSICLEN)
+       && (f->data[9] & FRAME_EXT_RXWINDOW)
+       && ((downlink[1] == 0xff) || (downlink[1] == f->data[1]))) {
+        senddownlink();
+      }
+      if ((framesok % GW_STATSEVERY) == 0) {
+        sendstats();
+      }
+    } else {
+      framesbad++;
+    }
+    rxtail = (rxtail + 1) & (RXRINGSIZE - 1);
+  }
+}
@@ -0,0 +1,434 @@
+/* $Id: gwsim.c $
+ * Runs the gateway firmware (gateway.c) on the host, to test it without
+ * any hardware. gateway.c is compiled unchanged against the stand-in AVR
+ * headers in hostsim/, and this file plays the hardware around it:
+ *  - the RFM69: rfm69_* put simulated frames "on air", raise DIO0 and
+ *    call the INT0 handler, just like the real radio would. Most frames
+ *    are valid, some have a wrong startbyte or CRC, some are longer
+ *    because of additional sensors or diagnostic counters (too long for
+ *    the firmware unless it is built with a larger GW_MAXFRAMELEN), some
+ *    arrive in bursts that overflow the receive buffer, and for some the
+ *    edge on DIO0 is "missed", so the main loop has to pick them up.
+ *    Some announce a receive window for configuration over the air.
+ *  - the USART: every byte the firmware sends is written to stdout,
+ *    bytes arriving on stdin are fed to the receive interrupt handler.
+ * Interrupts are run whenever the firmware enables them (sei()) or goes
+ * to sleep.
+ *
+ * On top of that, everything the firmware sends is checked: Every valid
+ * frame has to come out exactly once, in order, with its RSSI, nothing
+ * else may come out, and the statistics have to match. With a config
+ * frame handed to the firmware, it has to be sent exactly once after
+ * every valid frame from its sensor that announces a receive window,
+ * and never otherwise. Errors and a
+ * summary at the end are printed to stderr, and the exit code is 1 if
+ * anything was wrong. Example:
+ *   make gwsim hostgateway
+ *   GWSIM_FRAMES=10000 GWSIM_INTERVAL=0 ./gwsim | ./hostgateway /dev/stdin
+ * Settings are taken from the environment:
+ *   GWSIM_SENSORS   number of sensors (default 20)
+ *   GWSIM_INTERVAL  time in ms for one round over all sensors (default
+ *                   1000, 0 = as fast as possible)
+ *   GWSIM_FRAMES    stop after that many frames (default 0 = never)
+ *   GWSIM_DOWNLINK  hand the firmware a config frame for that sensor ID
+ *                   right at the start, like hostgateway -k would (255 =
+ *                   all sensors, default: none)
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+#include "crc.h"
+#include "frame.h"
+#include "ota.h"
+#include "rfm69.h"
+
+/* The registers used by gateway.c */
+volatile uint8_t PORTB, DDRB, PINB, PORTD, DDRD, PIND;
+volatile uint8_t SPDR, SPSR, SPCR, PRR, MCUSR;
+volatile uint8_t UDR0, UCSR0A, UCSR0B, UCSR0C;
+volatile uint16_t UBRR0;
+volatile uint8_t EICRA, EIMSK, EIFR;
+
+/* The interrupt handlers in gateway.c */
+void INT0_vect(void);
+void USART_UDRE_vect(void);
+void USART_RX_vect(void);
+
+#define MAXFRAMELEN 64
+/* How many valid frames can be on their way through the firmware */
+#define EXPECTSIZE 256
+/* Frames in a burst. More than fit into the receive buffer. */
+#define BURSTLEN 24
+
+static int nsensors = 20;
+static int intervalms = 1000;
+static unsigned long maxframes = 0;
+static int stdinopen = 1;
+static int dltarget = -1;   /* sensor ID of the config frame, -1 = none */
+
+/* The radio */
+static uint8_t rxlen = 0;   /* as set by rfm69_initreceiver() */
+static uint8_t air[MAXFRAMELEN];
+static uint8_t airrssi;
+static int rssiread;        /* did the firmware fetch the RSSI of it? */
+
+/* Valid frames the firmware has to send out, in order */
+struct expect {
+  uint8_t frame[MAXFRAMELEN];
+  uint8_t len;
+  uint8_t rssi;
+  uint32_t badbefore; /* invalid frames processed before this one */
+};
+static struct expect expected[EXPECTSIZE];
+static unsigned int exphead = 0;
+static unsigned int exptail = 0;
+
+/* Record being parsed from the serial output */
+static uint8_t outrec[260];
+static unsigned int outpos = 0;
+
+/* Statistics */
+static unsigned long framessent = 0;
+static uint32_t simok = 0;       /* valid frames sent out by the firmware */
+static uint32_t simbad = 0;      /* invalid frames that were not dropped */
+static uint32_t simdropped = 0;  /* frames the firmware had no space for */
+static uint32_t lastbadbefore = 0;
+static unsigned long downlinks = 0;
+static unsigned long downlinksexpected = 0;
+static unsigned long errors = 0;
+static uint32_t seed = 4711;
+
+static uint32_t rnd(void)
+{
+  seed = seed * 1103515245u + 12345u;
+  return seed >> 8;
+}
+
+static void simerror(const char * m)
+{
+  fprintf(stderr, "gwsim: ERROR after %lu frames: %s\n", framessent, m);
+  errors++;
+}
+
+static uint32_t getu32(uint8_t * p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+       | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* Checks a complete record sent by the firmware */
+static void checkrecord(uint8_t * r)
+{
+  uint8_t len = r[2];
+  uint8_t chk = 0;
+  unsigned int i;
+  for (i = 1; i < (unsigned int)len + 3; i++) {
+    chk ^= r[i];
+  }
+  if (chk != r[len + 3]) {
+    simerror("record with bad checksum");
+    return;
+  }
+  if (r[1] == 'F') {
+    struct expect * e = &expected[exptail];
+    if (exptail == exphead) {
+      simerror("frame sent out that we never sent");
+      return;
+    }
+    if ((len != e->len + 1) || (memcmp(&r[3], e->frame, e->len) != 0)
+     || (r[3 + e->len] != e->rssi)) {
+      simerror("frame sent out does not match the next valid one");
+    }
+    lastbadbefore = e->badbefore;
+    exptail = (exptail + 1) % EXPECTSIZE;
+    simok++;
+  } else if (r[1] == 'S') {
+    if ((len != 12) || (getu32(&r[3]) != simok)
+     || (getu32(&r[7]) != lastbadbefore) || (getu32(&r[11]) != simdropped)) {
+      simerror("statistics do not match");
+    }
+  } else if (r[1] != 'T') {
+    simerror("record of unknown type");
+  }
+}
+
+/* The firmware sent a byte */
+static void uartout(uint8_t b)
+{
+  if (write(1, &b, 1) != 1) {
+    exit(0); /* Whoever reads us is gone */
+  }
+  if ((outpos == 0) && (b != 0xA5)) {
+    simerror("garbage between records");
+    return;
+  }
+  outrec[outpos++] = b;
+  if ((outpos >= 3) && (outpos == (unsigned int)outrec[2] + 4)) {
+    checkrecord(outrec);
+    outpos = 0;
+  }
+}
+
+/* Runs the interrupts that are pending, called on sei(). */
+void gwsim_pending(void)
+{
+  /* USART data register empty: As long as the handler finds something
+   * to send, it leaves the interrupt enabled. */
+  while (UCSR0B & _BV(UDRIE0)) {
+    USART_UDRE_vect();
+    if (UCSR0B & _BV(UDRIE0)) {
+      uartout(UDR0);
+    }
+  }
+  /* USART receive */
+  while (stdinopen && (UCSR0B & _BV(RXCIE0))) {
+    fd_set fds;
+    struct timeval tv = { 0, 0 };
+    uint8_t b;
+    FD_ZERO(&fds);
+    FD_SET(0, &fds);
+    if (select(1, &fds, NULL, NULL, &tv) <= 0) {
+      break;
+    }
+    if (read(0, &b, 1) != 1) {
+      stdinopen = 0;
+      break;
+    }
+    UDR0 = b;
+    USART_RX_vect();
+  }
+}
+
+/* Puts a frame of len bytes on air. The receiver always receives rxlen
+ * bytes, anything after the frame is noise. */
+static void putonair(uint8_t * f, uint8_t len)
+{
+  uint8_t i;
+  for (i = 0; i < MAXFRAMELEN; i++) {
+    air[i] = (i < len) ? f[i] : (rnd() & 0xff);
+  }
+  airrssi = 100 + (rnd() % 120);
+  rssiread = 0;
+  PIND |= _BV(PD2); /* PayloadReady */
+}
+
+/* Hands the firmware a config frame for sensor id through its USART. */
+static void senddownlinkrecord(uint8_t id)
+{
+  uint8_t r[OTA_FRAMELEN + 4];
+  uint8_t i;
+  r[0] = 0xA5;
+  r[1] = 'D';
+  r[2] = OTA_FRAMELEN;
+  r[OTA_FRAMELEN + 3] = 'D' ^ OTA_FRAMELEN;
+  for (i = 0; i < OTA_FRAMELEN; i++) {
+    r[3 + i] = (i == 0) ? 0xCD : ((i == 1) ? id : i);
+    r[OTA_FRAMELEN + 3] ^= r[3 + i];
+  }
+  for (i = 0; i < OTA_FRAMELEN + 4; i++) {
+    UDR0 = r[i];
+    USART_RX_vect();
+  }
+}
+
+/* Builds a frame from sensor s. kind 0 = valid, 1 = wrong startbyte,
+ * 2 = bad CRC. Depending on the sensor, the frame carries data from
+ * additional sensors, and some announce a receive window. Returns its
+ * length. */
+static uint8_t makeframe(uint8_t * f, int s, int kind)
+{
+  uint8_t ext = s & (FRAME_EXT_SHT4X_B | FRAME_EXT_BH1750);
+  if ((s & 4) && ((rnd() % 4) == 0)) {
+    ext |= FRAME_EXT_DIAG;
+  }
+  if ((rnd() % 8) == 0) {
+    ext |= FRAME_EXT_RXWINDOW;
+  }
+  uint8_t pos = 9;
+  uint16_t rt = 24000 + (rnd() % 2000);
+  uint16_t rh = 25000 + (rnd() % 4000);
+  f[0] = 0xCC;
+  f[1] = s & 0xff;
+  f[3] = 0xf7;
+  f[4] = rt >> 8;
+  f[5] = rt & 0xff;
+  f[6] = rh >> 8;
+  f[7] = rh & 0xff;
+  f[8] = 200 + (rnd() % 40);
+  if (ext != 0) {
+    f[pos++] = ext;
+    if (ext & FRAME_EXT_SHT4X_B) {
+      f[pos++] = rt >> 8;
+      f[pos++] = (rt + 100) & 0xff;
+      f[pos++] = rh >> 8;
+      f[pos++] = (rh + 100) & 0xff;
+    }
+    if (ext & FRAME_EXT_BH1750) {
+      f[pos++] = rnd() & 0xff;
+      f[pos++] = rnd() & 0xff;
+    }
+    if (ext & FRAME_EXT_DIAG) {
+      uint8_t i;
+      f[pos++] = 2 * FRAME_DIAG_COUNTERS;
+      for (i = 0; i < 2 * FRAME_DIAG_COUNTERS; i++) {
+        f[pos++] = (i & 1) ? (rnd() % 8) : 0;
+      }
+    }
+  }
+  f[2] = pos - 3;
+  if (kind == 1) { /* Only the startbyte is wrong, the CRC matches */
+    f[0] = 0x90 | (rnd() & 0x0f);
+  }
+  f[pos] = calculatecrc(f, pos);
+  if (kind == 2) {
+    f[pos] ^= 1 << (rnd() % 8);
+  }
+  return pos + 1;
+}
+
+/* Sends one frame from sensor s. If missedge is set, the INT0 handler
+ * is not called, the main loop has to notice by itself. */
+static void sendframe(int s, int kind, int missedge)
+{
+  uint8_t f[MAXFRAMELEN];
+  uint8_t len = makeframe(f, s, kind);
+  putonair(f, len);
+  framessent++;
+  if (!missedge && (EIMSK & _BV(INT0))) {
+    INT0_vect();
+  }
+  if (!rssiread && !(PIND & _BV(PD2))) {
+    /* Fetched from the FIFO, but no RSSI: no space, thrown away. */
+    simdropped++;
+    return;
+  }
+  if ((kind != 0) || (len > rxlen)) { /* The firmware cannot take it */
+    simbad++;
+    return;
+  }
+  unsigned int nh = (exphead + 1) % EXPECTSIZE;
+  if (nh == exptail) {
+    fprintf(stderr, "gwsim: firmware does not send out anything?!\n");
+    exit(1);
+  }
+  memcpy(expected[exphead].frame, f, len);
+  expected[exphead].len = len;
+  expected[exphead].rssi = airrssi;
+  expected[exphead].badbefore = simbad;
+  exphead = nh;
+  if ((len > FRAME_CLASSICLEN) && (f[9] & FRAME_EXT_RXWINDOW)
+   && ((dltarget == 0xff) || (dltarget == f[1]))) {
+    downlinksexpected++;
+  }
+}
+
+static void finish(void)
+{
+  if (exptail != exphead) {
+    simerror("valid frames were never sent out");
+  }
+  if (downlinks != downlinksexpected) {
+    fprintf(stderr, "gwsim: %lu config frames expected\n", downlinksexpected);
+    simerror("config frames not sent when they should, or when they should not");
+  }
+  fprintf(stderr, "gwsim: %lu frames sent, %u valid ones sent out, %u invalid, "
+          "%u dropped by the firmware, %lu config frames sent, %lu errors\n",
+          framessent, simok, simbad, simdropped, downlinks, errors);
+  exit(errors > 0);
+}
+
+/* The firmware goes to sleep: Nothing left to do for it, so the next
+ * frame arrives. */
+void gwsim_sleep(void)
+{
+  static int s = 0;
+  static int initialized = 0;
+  if (!initialized) {
+    if (getenv("GWSIM_SENSORS") != NULL) {
+      nsensors = atoi(getenv("GWSIM_SENSORS"));
+    }
+    if (getenv("GWSIM_INTERVAL") != NULL) {
+      intervalms = atoi(getenv("GWSIM_INTERVAL"));
+    }
+    if (getenv("GWSIM_FRAMES") != NULL) {
+      maxframes = strtoul(getenv("GWSIM_FRAMES"), NULL, 10);
+    }
+    if (nsensors < 1) {
+      nsensors = 1;
+    }
+    if (getenv("GWSIM_DOWNLINK") != NULL) {
+      dltarget = atoi(getenv("GWSIM_DOWNLINK")) & 0xff;
+      senddownlinkrecord(dltarget);
+    }
+    initialized = 1;
+  }
+  gwsim_pending();
+  if (PIND & _BV(PD2)) {
+    simerror("firmware went to sleep with a frame in the FIFO");
+    PIND &= (uint8_t)~_BV(PD2);
+  }
+  if ((maxframes > 0) && (framessent >= maxframes)) {
+    finish();
+  }
+  if (intervalms > 0) {
+    usleep((intervalms * 1000) / nsensors);
+  }
+  uint32_t r = rnd() % 100;
+  if (r < 2) { /* Lots of frames at once */
+    int i;
+    for (i = 0; i < BURSTLEN; i++) {
+      sendframe(s, 0, 0);
+      s = (s + 1) % nsensors;
+    }
+    return;
+  }
+  sendframe(s, (r < 5) ? 1 : ((r < 8) ? 2 : 0), (r >= 95));
+  s = (s + 1) % nsensors;
+}
+
+/* The RFM69. Only what gateway.c uses. */
+void rfm69_initport(void) { }
+void rfm69_initchip(void) { }
+void rfm69_setreceiver(uint8_t e) { (void)e; }
+
+void rfm69_initreceiver(uint8_t length)
+{
+  if (length > MAXFRAMELEN) {
+    fprintf(stderr, "gwsim: receive length %u too large\n", length);
+    exit(1);
+  }
+  rxlen = length;
+}
+
+uint8_t rfm69_readrssi(void)
+{
+  rssiread = 1;
+  return airrssi;
+}
+
+void rfm69_readfifo(uint8_t * data, uint8_t length)
+{
+  if (!(PIND & _BV(PD2))) {
+    simerror("firmware read the FIFO without a frame in it");
+  }
+  if (length != rxlen) {
+    simerror("firmware read a different length than it set up");
+  }
+  memcpy(data, air, length);
+  PIND &= (uint8_t)~_BV(PD2);
+}
+
+void rfm69_sendarray(uint8_t * data, uint8_t length)
+{
+  downlinks++;
+  if ((length != OTA_FRAMELEN) || (dltarget < 0) || (data[1] != dltarget)) {
+    simerror("config frame sent that we never handed over");
+  }
+}
@@ -0,0 +1,365 @@
+/* $Id: hostgateway.c $
+ * Host side tool for the foxtemp2022 gateway firmware (gateway.c).
+ * It reads the binary records the gateway sends over its serial port,
+ * checks them, and prints one line per received frame:
+ *   <time in ms since epoch> <RSSI in dBm> <frame as hex> <decoded values>
+ * Statistics records are printed as comment lines starting with '#'.
+ *
+ * It can also hand a config frame for over-the-air configuration of the
+ * sensors (see ota.h) to the gateway, which will then send it to the
+ * sensor(s), e.g. to give sensor 17 the new ID 18:
+ *   ./hostgateway -k <key> -q <seq> -t 17 -I 18 /dev/ttyUSB0
+ * The sequence number has to be larger than that of the last update the
+ * sensor accepted. -x tells the gateway to stop sending it.
+ *
+ * There is also a simulation mode (-S), in which this tool does not read
+ * but writes records for a number of fake sensors in the format of the
+ * gateway. Together with a pty pair this allows testing everything
+ * downstream without any hardware (the firmware itself is not involved,
+ * see gwsim.c for that), e.g.:
+ *   socat pty,raw,echo=0,link=/tmp/gwa pty,raw,echo=0,link=/tmp/gwb &
+ *   ./hostgateway -S 50 /tmp/gwa &
+ *   ./hostgateway /tmp/gwb
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "crc.h"
+#include "frame.h"
+#include "hostutil.h"
+#include "ota.h"
+#include "xtea.h"
+
+static speed_t tospeed(long baud)
+{
+  switch (baud) {
+  case 9600:    return B9600;
+  case 57600:   return B57600;
+  case 115200:  return B115200;
+  case 230400:  return B230400;
+#ifdef B500000
+  case 500000:  return B500000;
+#endif
+#ifdef B1000000
+  case 1000000: return B1000000;
+#endif
+  }
+  fprintf(stderr, "Unsupported baudrate %ld\n", baud);
+  exit(1);
+}
+
+/* forwriting: 0 = read only, 1 = write only (created if needed), 2 = both */
+static int openport(const char * dev, long baud, int forwriting)
+{
+  int flags = O_RDONLY;
+  if (forwriting == 1) {
+    flags = O_WRONLY | O_CREAT | O_TRUNC;
+  } else if (forwriting == 2) {
+    flags = O_RDWR;
+  }
+  int fd = open(dev, flags | O_NOCTTY, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", dev, strerror(errno));
+    exit(1);
+  }
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) { /* Fails for plain files, that's OK */
+    cfmakeraw(&tio);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    cfsetspeed(&tio, tospeed(baud));
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+static uint64_t nowms(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static uint32_t getu32(uint8_t * p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+       | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t getu16(uint8_t * p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+/* Prints temperature and humidity from the raw values of a SHT4x */
+static void printsht4x(const char * suffix, uint8_t * p)
+{
+  if ((getu16(&p[0]) == 0xffff) || (getu16(&p[2]) == 0xffff)) {
+    printf(" t%s=err h%s=err", suffix, suffix);
+    return;
+  }
+  printf(" t%s=%.2f h%s=%.2f", suffix, -45.0 + 175.0 * getu16(&p[0]) / 65535.0,
+         suffix, -6.0 + 125.0 * getu16(&p[2]) / 65535.0);
+}
+
+/* Names of the diagnostic counters, in the order of frame.h */
+static const char * diagnames[] = {
+  "resets", "retries", "busclears", "powercycles", "sensorfails",
+  "lbtbusy", "lbtgaveup", "otawindows", "otaok", "otabad", "otapolls"
+};
+#define NUMDIAGNAMES (sizeof(diagnames) / sizeof(diagnames[0]))
+
+/* Prints what additional sensors sent, see frame.h. Returns 0 if the
+ * frame contains something we do not know. */
+static int printext(uint8_t * f, uint8_t len)
+{
+  uint8_t ext = f[9];
+  uint8_t pos = 10;
+  if (ext & ~(FRAME_EXT_SHT4X_B | FRAME_EXT_BH1750 | FRAME_EXT_DIAG
+              | FRAME_EXT_RXWINDOW)) {
+    return 0;
+  }
+  if (ext & FRAME_EXT_SHT4X_B) {
+    if (pos + 4 > len - 1) {
+      return 0;
+    }
+    printsht4x("2", &f[pos]);
+    pos += 4;
+  }
+  if (ext & FRAME_EXT_BH1750) {
+    if (pos + 2 > len - 1) {
+      return 0;
+    }
+    if (getu16(&f[pos]) == 0xffff) {
+      printf(" lux=err");
+    } else {
+      printf(" lux=%.1f", getu16(&f[pos]) / 1.2);
+    }
+    pos += 2;
+  }
+  if (ext & FRAME_EXT_DIAG) {
+    unsigned int i;
+    if (pos + 1 + f[pos] > len - 1) {
+      return 0;
+    }
+    for (i = 0; i < f[pos] / 2u; i++) {
+      if (i < NUMDIAGNAMES) {
+        printf(" %s=%u", diagnames[i], getu16(&f[pos + 1 + 2 * i]));
+      } else {
+        printf(" diag%u=%u", i, getu16(&f[pos + 1 + 2 * i]));
+      }
+    }
+    pos += 1 + f[pos];
+  }
+  if (ext & FRAME_EXT_RXWINDOW) {
+    printf(" rxwindow");
+  }
+  return (pos == len - 1);
+}
+
+static void printframe(uint8_t * f, uint8_t len, uint8_t rssi)
+{
+  int i;
+  printf("%llu %d ", (unsigned long long)nowms(), -(int)rssi / 2);
+  for (i = 0; i < len; i++) {
+    printf("%02x", f[i]);
+  }
+  printf(" id=%u", f[1]);
+  if ((len >= FRAME_CLASSICLEN) && (f[2] + 4 == len) && (f[3] == 0xf7)) { /* FoxTemp */
+    printsht4x("", &f[4]);
+    printf(" bat=%.2f", 3.3 * f[8] / 255.0);
+    if ((len > FRAME_CLASSICLEN) && !printext(f, len)) {
+      printf(" ext=unknown");
+    }
+  }
+  printf("\n");
+}
+
+static void receive(int fd)
+{
+  uint8_t buf[260];
+  unsigned int have = 0;
+  uint32_t chkerrs = 0;
+  while (1) {
+    ssize_t r = read(fd, &buf[have], sizeof(buf) - have);
+    if (r <= 0) {
+      if ((r < 0) && (errno == EINTR)) {
+        continue;
+      }
+      break;
+    }
+    have += r;
+    /* Parse as many complete records as we have */
+    while (have > 0) {
+      if (buf[0] != 0xA5) { /* Resync: throw away until startbyte */
+        memmove(&buf[0], &buf[1], --have);
+        continue;
+      }
+      if ((have < 3) || (have < (unsigned int)buf[2] + 4)) {
+        break; /* Incomplete, need to read more */
+      }
+      unsigned int len = buf[2];
+      uint8_t chk = 0;
+      unsigned int i;
+      for (i = 1; i < len + 3; i++) {
+        chk ^= buf[i];
+      }
+      if (chk != buf[len + 3]) {
+        chkerrs++;
+        memmove(&buf[0], &buf[1], --have);
+        continue;
+      }
+      if ((buf[1] == 'F') && (len >= 2)) { /* Frame and RSSI */
+        printframe(&buf[3], len - 1, buf[3 + len - 1]);
+      } else if ((buf[1] == 'T') && (len == 3)) {
+        printf("# config sent to id=%u seq=%u\n", buf[3], (buf[4] << 8) | buf[5]);
+      } else if ((buf[1] == 'S') && (len == 12)) {
+        printf("# stats ok=%u bad=%u dropped=%u serialerrs=%u\n",
+               getu32(&buf[3]), getu32(&buf[7]), getu32(&buf[11]), chkerrs);
+      }
+      fflush(stdout);
+      have -= len + 4;
+      memmove(&buf[0], &buf[len + 4], have);
+    }
+  }
+}
+
+static void writerecord(int fd, uint8_t type, uint8_t * data, uint8_t len)
+{
+  uint8_t buf[260];
+  uint8_t chk = type ^ len;
+  unsigned int i;
+  buf[0] = 0xA5;
+  buf[1] = type;
+  buf[2] = len;
+  for (i = 0; i < len; i++) {
+    buf[3 + i] = data[i];
+    chk ^= data[i];
+  }
+  buf[3 + len] = chk;
+  if (write(fd, buf, len + 4) != len + 4) {
+    fprintf(stderr, "write failed: %s\n", strerror(errno));
+    exit(1);
+  }
+}
+
+/* Pretends to be a gateway receiving from nsensors FoxTemps. */
+static void simulate(int fd, int nsensors, int intervalms)
+{
+  uint32_t sent = 0;
+  int s;
+  while (1) {
+    for (s = 0; s < nsensors; s++) {
+      uint8_t f[FRAME_CLASSICLEN + 1];
+      uint16_t rt = 24000 + (rand() % 2000);
+      uint16_t rh = 25000 + (rand() % 4000);
+      f[0] = 0xCC;
+      f[1] = s & 0xff;
+      f[2] = 6;
+      f[3] = 0xf7;
+      f[4] = rt >> 8;
+      f[5] = rt & 0xff;
+      f[6] = rh >> 8;
+      f[7] = rh & 0xff;
+      f[8] = 200 + (rand() % 40);
+      f[9] = calculatecrc(f, 9);
+      f[10] = 100 + (rand() % 120); /* RSSI -50 to -110 dBm */
+      writerecord(fd, 'F', f, FRAME_CLASSICLEN + 1);
+      sent++;
+      usleep((intervalms * 1000) / nsensors);
+    }
+    uint8_t st[12] = { 0 };
+    st[0] = sent >> 24; st[1] = sent >> 16; st[2] = sent >> 8; st[3] = sent;
+    writerecord(fd, 'S', st, 12);
+  }
+}
+
+static void usage(const char * me)
+{
+  fprintf(stderr, "Usage: %s [-b baudrate] [-S numsensors [-i intervalms]] device\n", me);
+  fprintf(stderr, "       %s [-b baudrate] -k key -q seq [-t id] [-I newid] [-T interval] [-R rxevery] device\n", me);
+  fprintf(stderr, "       %s [-b baudrate] -x device\n", me);
+  fprintf(stderr, " -b  serial baudrate, default 500000 (same as the gateway firmware)\n");
+  fprintf(stderr, " -S  simulate a gateway with that many sensors, writing to device\n");
+  fprintf(stderr, " -i  in simulation mode, time for one round over all sensors (default 1000)\n");
+  fprintf(stderr, " -k  key for config updates, 32 hex digits, as set in the sensors EEPROM\n");
+  fprintf(stderr, " -q  sequence number for the config update (1 - 65535)\n");
+  fprintf(stderr, " -t  sensor ID the config update is for, default 255 = all\n");
+  fprintf(stderr, " -I/-T/-R  new sensor ID / transmit interval (in 8 s) /\n");
+  fprintf(stderr, "     config window every n-th transmission, at least one is needed\n");
+  fprintf(stderr, " -x  tell the gateway to stop sending the config update\n");
+  exit(1);
+}
+
+int main(int argc, char ** argv)
+{
+  long baud = 500000;
+  int simsensors = 0;
+  int intervalms = 1000;
+  uint8_t cfg[OTA_FRAMELEN] = { 0xCD, 0xff };
+  uint8_t key[16];
+  int haskey = 0;
+  long seq = 0;
+  int clearcfg = 0;
+  int c;
+  while ((c = getopt(argc, argv, "b:S:i:k:q:t:I:T:R:x")) != -1) {
+    switch (c) {
+    case 'b': baud = strtol(optarg, NULL, 10); break;
+    case 'S': simsensors = atoi(optarg); break;
+    case 'i': intervalms = atoi(optarg); break;
+    case 'k': haskey = parsekey(optarg, key);
+              if (!haskey) {
+                usage(argv[0]);
+              }
+              break;
+    case 'q': seq = strtol(optarg, NULL, 10); break;
+    case 't': cfg[1] = atoi(optarg); break;
+    case 'I': cfg[4] |= OTA_SET_SENSORID; cfg[5] = atoi(optarg); break;
+    case 'T': cfg[4] |= OTA_SET_TXINTERVAL; cfg[6] = atoi(optarg); break;
+    case 'R': cfg[4] |= OTA_SET_RXEVERY; cfg[7] = atoi(optarg); break;
+    case 'x': clearcfg = 1; break;
+    default:  usage(argv[0]);
+    }
+  }
+  if (optind != (argc - 1)) {
+    usage(argv[0]);
+  }
+  if ((haskey || (seq != 0)) && !clearcfg && (cfg[4] == 0)) {
+    usage(argv[0]); /* A config update that would not change anything */
+  }
+  if (clearcfg || (cfg[4] != 0)) {
+    if (!clearcfg && (!haskey || (seq < 1) || (seq > 65535))) {
+      usage(argv[0]);
+    }
+    int fd = openport(argv[optind], baud, 2);
+    if (clearcfg) {
+      writerecord(fd, 'D', cfg, 0);
+    } else {
+      cfg[2] = seq >> 8;
+      cfg[3] = seq & 0xff;
+      uint32_t mac = xtea_cbcmac(cfg, OTA_FRAMELEN - 4, key);
+      cfg[16] = mac >> 24;
+      cfg[17] = mac >> 16;
+      cfg[18] = mac >> 8;
+      cfg[19] = mac;
+      writerecord(fd, 'D', cfg, OTA_FRAMELEN);
+    }
+    receive(fd); /* So we see when it is sent */
+    return 0;
+  }
+  int fd = openport(argv[optind], baud, (simsensors > 0));
+  if (simsensors > 0) {
+    simulate(fd, simsensors, intervalms);
+  } else {
+    receive(fd);
+  }
+  return 0;
+}
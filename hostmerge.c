@@ -0,0 +1,512 @@
+/* $Id: hostmerge.c $
+ * Merges the output of several receivers (hostgateway, one per gateway)
+ * into one stream without duplicates.
+ *
+ * Every frame a sensor sends is usually heard by more than one gateway.
+ * The frames carry no sequence number, so duplicates are recognized by
+ * their content: Two frames are the same if they are identical (which
+ * includes the sensor ID) and arrived within a short time window of each
+ * other. Of all copies, the one with the best RSSI is kept. Output lines
+ * look like the input lines of hostgateway, with the number of the input
+ * that received the best copy and the number of copies appended:
+ *   <time in ms> <RSSI in dBm> <frame as hex> gw=<input> copies=<n>
+ *
+ * Every input is read by its own thread. The frames waiting for their
+ * window to close are kept in an open addressing hash table of fixed
+ * size, so memory use is bounded no matter how much comes in. The table is
+ * split into groups of GROUPSIZE slots, each with its own lock; a frame
+ * only ever lives in the group its hash selects. If a group is full,
+ * its oldest frame is written out early.
+ *
+ * Time is taken from the timestamps in the input, not from the clock, so
+ * captures can be replayed. A frame is written out once all inputs that
+ * are still open have reached a time later than its window. Output is
+ * therefore roughly, but not strictly, ordered by time. An input that
+ * has not delivered a frame for a while (-i, by the clock) is considered
+ * caught up, so a gateway that is silent or only sends statistics does
+ * not hold back the others.
+ *
+ * With -B, no inputs are read. Instead, synthetic captures of a number of
+ * gateways and sensors are generated in memory and pushed through the
+ * table as fast as possible, to measure throughput.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc.h"
+
+/* Longest frame we handle. The FIFO of the RFM69 holds 66 bytes. */
+#define MAXFRAMELEN 64
+#define GROUPSIZE 8
+#define MAXINPUTS 64
+
+struct entry {
+  uint64_t firstseen; /* in ms. 0 = slot is empty */
+  uint32_t hash;
+  int16_t rssi;       /* best RSSI seen, in dBm */
+  uint16_t copies;
+  uint8_t gw;         /* input that received the best copy */
+  uint8_t len;
+  uint8_t frame[MAXFRAMELEN];
+};
+
+struct group {
+  pthread_mutex_t lock;
+  struct entry slots[GROUPSIZE];
+};
+
+struct input {
+  const char * name;
+  int idx;
+  volatile uint64_t lasttime; /* newest timestamp seen on this input */
+  volatile uint64_t lastframe; /* clock (ms) when it last delivered a frame */
+  volatile int done;
+  /* Only for the benchmark: pregenerated frames */
+  struct entry * bench;
+  size_t benchcnt;
+};
+
+static struct group * table;
+static uint32_t numgroups; /* power of 2 */
+static uint64_t windowms = 2000;
+static uint64_t idlems = 5000;
+static struct input inputs[MAXINPUTS];
+static int numinputs = 0;
+static int benchmode = 0;
+static volatile int inputsrunning;
+
+static pthread_mutex_t outlock = PTHREAD_MUTEX_INITIALIZER;
+/* Statistics. Updated under outlock or with atomics. */
+static uint64_t statin = 0;
+static uint64_t statout = 0;
+static uint64_t statevicted = 0;
+static uint64_t statbadlines = 0;
+
+/* FNV-1a */
+static uint32_t framehash(const uint8_t * f, uint8_t len)
+{
+  uint32_t h = 2166136261u;
+  uint8_t i;
+  for (i = 0; i < len; i++) {
+    h ^= f[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/* Writes out an entry. Called with the lock of its group held. */
+static void emit(struct entry * e)
+{
+  pthread_mutex_lock(&outlock);
+  statout++;
+  if (!benchmode) {
+    int i;
+    printf("%llu %d ", (unsigned long long)e->firstseen, e->rssi);
+    for (i = 0; i < e->len; i++) {
+      printf("%02x", e->frame[i]);
+    }
+    printf(" gw=%d copies=%u\n", e->gw, e->copies);
+  }
+  pthread_mutex_unlock(&outlock);
+  e->firstseen = 0;
+}
+
+/* Adds a frame received by input gw at time t. */
+static void addframe(uint64_t t, int16_t rssi, const uint8_t * f, uint8_t len, uint8_t gw)
+{
+  uint32_t h = framehash(f, len);
+  struct group * g = &table[h & (numgroups - 1)];
+  struct entry * freeslot = NULL;
+  struct entry * oldest = NULL;
+  int i;
+  if (t == 0) { /* 0 marks empty slots */
+    t = 1;
+  }
+  __atomic_add_fetch(&statin, 1, __ATOMIC_RELAXED);
+  pthread_mutex_lock(&g->lock);
+  for (i = 0; i < GROUPSIZE; i++) {
+    struct entry * e = &g->slots[i];
+    if (e->firstseen == 0) {
+      if (freeslot == NULL) {
+        freeslot = e;
+      }
+      continue;
+    }
+    if ((e->hash == h) && (e->len == len) && (memcmp(e->frame, f, len) == 0)
+     && (t < e->firstseen + windowms) && (e->firstseen < t + windowms)) {
+      /* Duplicate */
+      e->copies++;
+      if (rssi > e->rssi) {
+        e->rssi = rssi;
+        e->gw = gw;
+      }
+      if (t < e->firstseen) {
+        e->firstseen = t;
+      }
+      pthread_mutex_unlock(&g->lock);
+      return;
+    }
+    if ((oldest == NULL) || (e->firstseen < oldest->firstseen)) {
+      oldest = e;
+    }
+  }
+  if (freeslot == NULL) { /* Group is full, make room. */
+    emit(oldest);
+    __atomic_add_fetch(&statevicted, 1, __ATOMIC_RELAXED);
+    freeslot = oldest;
+  }
+  freeslot->hash = h;
+  freeslot->rssi = rssi;
+  freeslot->copies = 1;
+  freeslot->gw = gw;
+  freeslot->len = len;
+  memcpy(freeslot->frame, f, len);
+  freeslot->firstseen = t;
+  pthread_mutex_unlock(&g->lock);
+}
+
+static uint64_t clockms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Returns the time all inputs that are still open and not idle have
+ * reached. */
+static uint64_t watermark(void)
+{
+  uint64_t wm = UINT64_MAX;
+  uint64_t idlesince = 0;
+  int i;
+  if (!benchmode && (idlems > 0)) {
+    uint64_t now = clockms();
+    idlesince = (now > idlems) ? (now - idlems) : 0;
+  }
+  for (i = 0; i < numinputs; i++) {
+    struct input * in = &inputs[i];
+    if (in->done || (__atomic_load_n(&in->lastframe, __ATOMIC_ACQUIRE) < idlesince)) {
+      continue;
+    }
+    if (in->lasttime < wm) {
+      wm = in->lasttime;
+    }
+  }
+  return wm;
+}
+
+/* Writes out everything whose window closed before wm. */
+static void sweep(uint64_t wm)
+{
+  uint32_t gi;
+  int i;
+  for (gi = 0; gi < numgroups; gi++) {
+    struct group * g = &table[gi];
+    pthread_mutex_lock(&g->lock);
+    for (i = 0; i < GROUPSIZE; i++) {
+      struct entry * e = &g->slots[i];
+      if ((e->firstseen != 0) && ((wm == UINT64_MAX) || (e->firstseen + windowms <= wm))) {
+        emit(e);
+      }
+    }
+    pthread_mutex_unlock(&g->lock);
+  }
+}
+
+static void * flusher(void * arg)
+{
+  (void)arg;
+  while (__atomic_load_n(&inputsrunning, __ATOMIC_ACQUIRE) > 0) {
+    uint64_t wm = watermark();
+    if (wm > windowms) { /* UINT64_MAX: all inputs idle, flush everything */
+      sweep(wm);
+    }
+    if (!benchmode) {
+      fflush(stdout);
+    }
+    usleep(10000);
+  }
+  sweep(UINT64_MAX); /* All inputs closed, flush the rest. */
+  fflush(stdout);
+  return NULL;
+}
+
+static int hexval(char c)
+{
+  if ((c >= '0') && (c <= '9')) return c - '0';
+  if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+  if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+  return -1;
+}
+
+/* Parses one line of hostgateway output. Returns 1 on success. */
+static int parseline(const char * l, uint64_t * t, int16_t * rssi, uint8_t * f, uint8_t * len)
+{
+  unsigned long long tt;
+  int r;
+  char hex[2 * MAXFRAMELEN + 2];
+  if (sscanf(l, "%llu %d %129s", &tt, &r, hex) != 3) {
+    return 0;
+  }
+  size_t hl = strlen(hex);
+  if ((hl == 0) || (hl % 2) || (hl > 2 * MAXFRAMELEN)) {
+    return 0;
+  }
+  size_t i;
+  for (i = 0; i < hl / 2; i++) {
+    int h1 = hexval(hex[2 * i]);
+    int h2 = hexval(hex[2 * i + 1]);
+    if ((h1 < 0) || (h2 < 0)) {
+      return 0;
+    }
+    f[i] = (h1 << 4) | h2;
+  }
+  *t = tt;
+  *rssi = r;
+  *len = hl / 2;
+  return 1;
+}
+
+static void * reader(void * arg)
+{
+  struct input * in = arg;
+  FILE * fp = stdin;
+  char line[512];
+  __atomic_store_n(&in->lastframe, clockms(), __ATOMIC_RELEASE);
+  if (strcmp(in->name, "-") != 0) {
+    fp = fopen(in->name, "r");
+    if (fp == NULL) {
+      fprintf(stderr, "Failed to open %s: %s\n", in->name, strerror(errno));
+      goto out;
+    }
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    uint64_t t;
+    int16_t rssi;
+    uint8_t f[MAXFRAMELEN];
+    uint8_t len;
+    if (line[0] == '#') { /* Statistics or comments */
+      continue;
+    }
+    if (!parseline(line, &t, &rssi, f, &len)) {
+      __atomic_add_fetch(&statbadlines, 1, __ATOMIC_RELAXED);
+      continue;
+    }
+    addframe(t, rssi, f, len, in->idx);
+    if (t > in->lasttime) {
+      __atomic_store_n(&in->lasttime, t, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&in->lastframe, clockms(), __ATOMIC_RELEASE);
+  }
+  if (fp != stdin) {
+    fclose(fp);
+  }
+out:
+  __atomic_store_n(&in->done, 1, __ATOMIC_RELEASE);
+  __atomic_sub_fetch(&inputsrunning, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static void * benchreader(void * arg)
+{
+  struct input * in = arg;
+  size_t i;
+  for (i = 0; i < in->benchcnt; i++) {
+    struct entry * e = &in->bench[i];
+    /* Real gateways deliver in real time, so they never get far ahead of
+     * each other. Our threads would, so keep them within one window. */
+    while ((i % 256) == 0) {
+      uint64_t wm = watermark();
+      if ((wm == UINT64_MAX) || (e->firstseen <= wm + windowms / 2)) {
+        break;
+      }
+      sched_yield();
+    }
+    addframe(e->firstseen, e->rssi, e->frame, e->len, in->idx);
+    __atomic_store_n(&in->lasttime, e->firstseen, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&in->done, 1, __ATOMIC_RELEASE);
+  __atomic_sub_fetch(&inputsrunning, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/* Generates synthetic captures: nsens sensors, each sending every 24 to
+ * 32 seconds like the real firmware, received by each of ngw gateways
+ * with 80% probability and up to 50 ms of delay.
+ * Returns the number of distinct frames that were received at all. */
+static uint64_t genbench(int ngw, int nsens, uint64_t totalframes)
+{
+  int g;
+  size_t cap = totalframes / ngw + 16;
+  uint64_t unique = 0;
+  uint64_t * nexttx = malloc(nsens * sizeof(uint64_t));
+  uint32_t seed = 12345;
+  int s;
+#define RND() (seed = seed * 1103515245u + 12345u, (seed >> 8))
+  for (g = 0; g < ngw; g++) {
+    inputs[g].bench = malloc(cap * sizeof(struct entry));
+    inputs[g].benchcnt = 0;
+    if (inputs[g].bench == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+  }
+  for (s = 0; s < nsens; s++) {
+    nexttx[s] = 1000000 + RND() % 32000;
+  }
+  /* Step through time in 1 ms steps, the sensors transmit in order. */
+  uint64_t now = 1000000;
+  uint64_t generated = 0;
+  while (generated < totalframes) {
+    for (s = 0; (s < nsens) && (generated < totalframes); s++) {
+      if (nexttx[s] != now) {
+        continue;
+      }
+      uint8_t f[10];
+      uint16_t rt = 24000 + RND() % 2000;
+      uint16_t rh = 25000 + RND() % 4000;
+      f[0] = 0xCC; f[1] = s & 0xff; f[2] = 6; f[3] = 0xf7;
+      f[4] = rt >> 8; f[5] = rt & 0xff; f[6] = rh >> 8; f[7] = rh & 0xff;
+      f[8] = 200 + RND() % 40;
+      f[9] = calculatecrc(f, 9);
+      int heard = 0;
+      for (g = 0; (g < ngw) && (generated < totalframes); g++) {
+        if ((RND() % 100) >= 80) {
+          continue;
+        }
+        if (inputs[g].benchcnt >= cap) {
+          continue;
+        }
+        struct entry * e = &inputs[g].bench[inputs[g].benchcnt++];
+        /* Frames arrive delayed, but per gateway in order, as on a real
+         * serial line. */
+        e->firstseen = now + RND() % 50;
+        if ((inputs[g].benchcnt > 1) && (e->firstseen < e[-1].firstseen)) {
+          e->firstseen = e[-1].firstseen;
+        }
+        e->rssi = -50 - (int16_t)(RND() % 60);
+        e->len = 10;
+        memcpy(e->frame, f, 10);
+        generated++;
+        heard = 1;
+      }
+      unique += heard;
+      nexttx[s] = now + 24000 + RND() % 8001;
+    }
+    now++;
+  }
+  for (g = 0; g < ngw; g++) {
+    if (inputs[g].benchcnt > 0) { /* So the pacing can start */
+      inputs[g].lasttime = inputs[g].bench[0].firstseen;
+    }
+  }
+  free(nexttx);
+  return unique;
+#undef RND
+}
+
+static double nowsec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char * me)
+{
+  fprintf(stderr, "Usage: %s [-w windowms] [-i idlems] [-s slots] input [input ...]\n", me);
+  fprintf(stderr, "       %s -B [-g gateways] [-n sensors] [-f frames] [-w windowms] [-s slots]\n", me);
+  fprintf(stderr, " inputs are files or fifos with hostgateway output, - is stdin\n");
+  fprintf(stderr, " -w  time window for duplicates, default 2000 ms\n");
+  fprintf(stderr, " -i  do not wait for inputs that sent no frame for that long,\n");
+  fprintf(stderr, "     default 5000 ms, 0 = always wait\n");
+  fprintf(stderr, " -s  number of slots in the table (rounded up to a power of 2), default 262144\n");
+  fprintf(stderr, " -B  benchmark with synthetic captures\n");
+  exit(1);
+}
+
+int main(int argc, char ** argv)
+{
+  uint64_t slots = 262144;
+  int benchgw = 4;
+  int benchsensors = 2000;
+  uint64_t benchframes = 5000000;
+  int c, i;
+  while ((c = getopt(argc, argv, "w:i:s:Bg:n:f:")) != -1) {
+    switch (c) {
+    case 'w': windowms = strtoull(optarg, NULL, 10); break;
+    case 'i': idlems = strtoull(optarg, NULL, 10); break;
+    case 's': slots = strtoull(optarg, NULL, 10); break;
+    case 'B': benchmode = 1; break;
+    case 'g': benchgw = atoi(optarg); break;
+    case 'n': benchsensors = atoi(optarg); break;
+    case 'f': benchframes = strtoull(optarg, NULL, 10); break;
+    default:  usage(argv[0]);
+    }
+  }
+  numgroups = 1;
+  while ((uint64_t)numgroups * GROUPSIZE < slots) {
+    numgroups <<= 1;
+  }
+  table = calloc(numgroups, sizeof(struct group));
+  if (table == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  for (i = 0; i < (int)numgroups; i++) {
+    pthread_mutex_init(&table[i].lock, NULL);
+  }
+  uint64_t expected = 0;
+  if (benchmode) {
+    if ((benchgw < 1) || (benchgw > MAXINPUTS) || (benchsensors < 1)) {
+      usage(argv[0]);
+    }
+    numinputs = benchgw;
+    expected = genbench(benchgw, benchsensors, benchframes);
+  } else {
+    numinputs = argc - optind;
+    if ((numinputs < 1) || (numinputs > MAXINPUTS)) {
+      usage(argv[0]);
+    }
+    for (i = 0; i < numinputs; i++) {
+      inputs[i].name = argv[optind + i];
+    }
+  }
+  pthread_t threads[MAXINPUTS];
+  pthread_t flushthread;
+  inputsrunning = numinputs;
+  double start = nowsec();
+  for (i = 0; i < numinputs; i++) {
+    inputs[i].idx = i;
+    pthread_create(&threads[i], NULL, (benchmode ? benchreader : reader), &inputs[i]);
+  }
+  pthread_create(&flushthread, NULL, flusher, NULL);
+  for (i = 0; i < numinputs; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_join(flushthread, NULL);
+  double elapsed = nowsec() - start;
+  fprintf(stderr, "# in=%llu out=%llu duplicates=%llu evicted=%llu badlines=%llu\n",
+          (unsigned long long)statin, (unsigned long long)statout,
+          (unsigned long long)(statin - statout),
+          (unsigned long long)statevicted, (unsigned long long)statbadlines);
+  if (benchmode) {
+    fprintf(stderr, "# %d gateways, %d sensors, table %u slots (%zu KB), window %llu ms\n",
+            numinputs, benchsensors, numgroups * GROUPSIZE,
+            (size_t)numgroups * sizeof(struct group) / 1024,
+            (unsigned long long)windowms);
+    fprintf(stderr, "# expected unique frames %llu, got %llu\n",
+            (unsigned long long)expected, (unsigned long long)statout);
+    fprintf(stderr, "# %.3f s, %.0f frames/s, %.1f million frames/min\n",
+            elapsed, statin / elapsed, statin / elapsed * 60.0 / 1e6);
+  }
+  return 0;
+}
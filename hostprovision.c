@@ -0,0 +1,273 @@
+/* $Id: hostprovision.c $
+ * Provisions foxtemp2022 sensors through their serial port (see
+ * provision.h for the protocol), any number of them in parallel.
+ *
+ * Every device gets its own thread. It resets the device by toggling DTR
+ * (the FTDI connector of the Canique MK2 is wired for that), waits for the
+ * firmware to announce its provisioning window, sends the config block
+ * and waits for the confirmation. The devices need to run a firmware that
+ * supports provisioning already - but that is the same firmware for all of
+ * them, so it can be flashed long before.
+ *
+ * Each device is given as port[:sensorid]. Without an explicit sensor ID,
+ * the devices get consecutive IDs starting at the one given with -I.
+ * Without -k, the devices keep the key they have; to remove it (which
+ * disables configuration over the air), give a key of 32 f's.
+ * Example:
+ *   ./hostprovision -I 20 -k <key> /dev/ttyUSB0 /dev/ttyUSB1 /dev/ttyUSB2:42
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "hostutil.h"
+#include "provision.h"
+
+#define MAXDEVICES 64
+/* How often we try (each time resetting the device) before giving up */
+#define MAXTRIES 3
+/* How long to wait for the firmware after the reset. optiboot alone
+ * waits about a second for an upload before starting it. */
+#define BOOTTIMEOUTMS 5000
+
+struct device {
+  char port[256];
+  pthread_t thread;
+  uint8_t block[PROV_BLOCKLEN];
+  int blocklen;
+  int oldid;   /* as announced by the device */
+  int result;  /* 1 = success */
+  double secs; /* how long it took */
+};
+
+static struct device devices[MAXDEVICES];
+static pthread_mutex_t outlock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Same as _crc_ccitt_update from avr-libc */
+static uint16_t crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+  data ^= (crc & 0xff);
+  data ^= data << 4;
+  return ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4)
+          ^ ((uint16_t)data << 3));
+}
+
+static double nowsec(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Reads one byte, waiting up to timeoutms. Returns -1 on timeout. */
+static int readbyte(int fd, int timeoutms)
+{
+  fd_set fds;
+  struct timeval tv;
+  uint8_t b;
+  FD_ZERO(&fds);
+  FD_SET(fd, &fds);
+  tv.tv_sec = timeoutms / 1000;
+  tv.tv_usec = (timeoutms % 1000) * 1000;
+  if (select(fd + 1, &fds, NULL, NULL, &tv) <= 0) {
+    return -1;
+  }
+  if (read(fd, &b, 1) != 1) {
+    return -1;
+  }
+  return b;
+}
+
+static void msg(struct device * d, const char * m)
+{
+  pthread_mutex_lock(&outlock);
+  fprintf(stderr, "%s: %s\n", d->port, m);
+  pthread_mutex_unlock(&outlock);
+}
+
+/* One try: reset, wait for the announcement, send, wait for the answer. */
+static int provisionone(struct device * d, int fd)
+{
+  int modem = TIOCM_DTR;
+  /* Pulling DTR resets the device through the FTDI connector */
+  ioctl(fd, TIOCMBIC, &modem);
+  usleep(100000);
+  tcflush(fd, TCIOFLUSH);
+  ioctl(fd, TIOCMBIS, &modem);
+  /* Look for 'F' 'T' '?' <version> <sensorid> */
+  double deadline = nowsec() + BOOTTIMEOUTMS / 1000.0;
+  int state = 0;
+  while (state < 5) {
+    int left = (int)((deadline - nowsec()) * 1000);
+    int c = (left > 0) ? readbyte(fd, left) : -1;
+    if (c < 0) {
+      msg(d, "device did not announce its provisioning window");
+      return 0;
+    }
+    if ((state == 0) && (c == 'F')) {
+      state = 1;
+    } else if ((state == 1) && (c == 'T')) {
+      state = 2;
+    } else if ((state == 2) && (c == '?')) {
+      state = 3;
+    } else if (state == 3) {
+      if (c != PROV_VERSION) {
+        msg(d, "device speaks a different version of the protocol");
+        return 0;
+      }
+      state = 4;
+    } else if (state == 4) {
+      d->oldid = c;
+      state = 5;
+    } else {
+      state = (c == 'F') ? 1 : 0;
+    }
+  }
+  if (write(fd, d->block, d->blocklen) != d->blocklen) {
+    msg(d, "write failed");
+    return 0;
+  }
+  /* Sending takes 125 ms, writing the EEPROM up to 150 ms more. */
+  int c = readbyte(fd, 1000);
+  if (c == 'K') {
+    return 1;
+  }
+  msg(d, (c == 'E') ? "device rejected the config block" : "no answer from device");
+  return 0;
+}
+
+static void * provisionthread(void * arg)
+{
+  struct device * d = arg;
+  double start = nowsec();
+  int tries;
+  int fd = open(d->port, O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    msg(d, strerror(errno));
+    return NULL;
+  }
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    cfsetspeed(&tio, B2400);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  for (tries = 0; (tries < MAXTRIES) && !d->result; tries++) {
+    d->result = provisionone(d, fd);
+  }
+  close(fd);
+  d->secs = nowsec() - start;
+  return NULL;
+}
+
+static void usage(const char * me)
+{
+  fprintf(stderr, "Usage: %s [options] port[:sensorid] [port[:sensorid] ...]\n", me);
+  fprintf(stderr, " -I  sensor ID for the first port without an explicit one,\n");
+  fprintf(stderr, "     counting up from there (default 1)\n");
+  fprintf(stderr, " -T  transmit interval, in multiples of 8 seconds (default 3)\n");
+  fprintf(stderr, " -R  listen for config updates after every n-th transmission (default 64)\n");
+  fprintf(stderr, " -P  radio profile, 0 = 17241 baud, 1 = 9579 baud (default: compiled in)\n");
+  fprintf(stderr, " -o  temperature offset in degrees celsius (default 0)\n");
+  fprintf(stderr, " -h  humidity offset in %% RH (default 0)\n");
+  fprintf(stderr, " -k  key for over-the-air config updates, 32 hex digits (default: keep\n");
+  fprintf(stderr, "     the one the device has, 32 f's remove it)\n");
+  exit(1);
+}
+
+int main(int argc, char ** argv)
+{
+  int nextid = 1;
+  uint8_t fields[PROV_FIELDSLEN];
+  double tempoff = 0.0;
+  double humoff = 0.0;
+  int fieldslen = PROV_FIELDSLEN_NOKEY;
+  int c, i;
+  memset(fields, 0, sizeof(fields));
+  fields[1] = 3;    /* transmit interval */
+  fields[2] = 64;   /* rxevery */
+  fields[3] = 0xff; /* radio profile */
+  while ((c = getopt(argc, argv, "I:T:R:P:o:h:k:")) != -1) {
+    switch (c) {
+    case 'I': nextid = atoi(optarg); break;
+    case 'T': fields[1] = atoi(optarg); break;
+    case 'R': fields[2] = atoi(optarg); break;
+    case 'P': fields[3] = atoi(optarg); break;
+    case 'o': tempoff = strtod(optarg, NULL); break;
+    case 'h': humoff = strtod(optarg, NULL); break;
+    case 'k': if (!parsekey(optarg, &fields[8])) {
+                usage(argv[0]);
+              }
+              fieldslen = PROV_FIELDSLEN;
+              break;
+    default:  usage(argv[0]);
+    }
+  }
+  int numdevices = argc - optind;
+  if ((numdevices < 1) || (numdevices > MAXDEVICES) || (fields[1] == 0)) {
+    usage(argv[0]);
+  }
+  /* Convert the offsets to raw sensor units, see the SHT4x datasheet */
+  int16_t rawtempoff = (int16_t)lround(tempoff * 65535.0 / 175.0);
+  int16_t rawhumoff = (int16_t)lround(humoff * 65535.0 / 125.0);
+  fields[4] = (uint16_t)rawtempoff >> 8;
+  fields[5] = rawtempoff & 0xff;
+  fields[6] = (uint16_t)rawhumoff >> 8;
+  fields[7] = rawhumoff & 0xff;
+  for (i = 0; i < numdevices; i++) {
+    struct device * d = &devices[i];
+    char * colon;
+    snprintf(d->port, sizeof(d->port), "%s", argv[optind + i]);
+    d->oldid = -1;
+    uint8_t * b = d->block;
+    b[0] = 'F';
+    b[1] = 'T';
+    b[2] = PROV_VERSION;
+    b[3] = fieldslen;
+    memcpy(&b[4], fields, fieldslen);
+    d->blocklen = 4 + fieldslen + 2;
+    colon = strrchr(d->port, ':');
+    if (colon != NULL) {
+      *colon = 0;
+      b[4] = atoi(colon + 1);
+    } else {
+      b[4] = nextid++;
+    }
+    uint16_t crc = 0xffff;
+    int j;
+    for (j = 0; j < d->blocklen - 2; j++) {
+      crc = crc_ccitt_update(crc, b[j]);
+    }
+    b[d->blocklen - 2] = crc >> 8;
+    b[d->blocklen - 1] = crc & 0xff;
+  }
+  double start = nowsec();
+  for (i = 0; i < numdevices; i++) {
+    pthread_create(&devices[i].thread, NULL, provisionthread, &devices[i]);
+  }
+  int failed = 0;
+  for (i = 0; i < numdevices; i++) {
+    struct device * d = &devices[i];
+    pthread_join(d->thread, NULL);
+    if (d->result) {
+      printf("%s: OK, sensor ID %d -> %d (%.1f s)\n", d->port, d->oldid, d->block[4], d->secs);
+    } else {
+      printf("%s: FAILED\n", d->port);
+      failed++;
+    }
+  }
+  printf("%d of %d devices provisioned in %.1f s\n",
+         numdevices - failed, numdevices, nowsec() - start);
+  return (failed > 0);
+}
@@ -0,0 +1,16 @@
+/* $Id: hostsim/avr/interrupt.h $
+ * Interrupt handlers become plain functions, which gwsim.c calls whenever
+ * the real hardware would run them: Pending interrupts run as soon as
+ * they are enabled again.
+ */
+
+#ifndef _HOSTSIM_AVR_INTERRUPT_H_
+#define _HOSTSIM_AVR_INTERRUPT_H_
+
+void gwsim_pending(void);
+
+#define ISR(vect) void vect(void)
+#define cli()
+#define sei() gwsim_pending()
+
+#endif /* _HOSTSIM_AVR_INTERRUPT_H_ */
@@ -0,0 +1,26 @@
+/* $Id: hostsim/avr/io.h $
+ * Stand-in for avr-libc's <avr/io.h>, just enough to build gateway.c on
+ * the host (see gwsim.c). The registers are plain variables there.
+ */
+
+#ifndef _HOSTSIM_AVR_IO_H_
+#define _HOSTSIM_AVR_IO_H_
+
+#include <stdint.h>
+
+#define _BV(b) (1 << (b))
+
+extern volatile uint8_t PORTB, DDRB, PINB, PORTD, DDRD, PIND;
+extern volatile uint8_t SPDR, SPSR, SPCR, PRR, MCUSR;
+extern volatile uint8_t UDR0, UCSR0A, UCSR0B, UCSR0C;
+extern volatile uint16_t UBRR0;
+extern volatile uint8_t EICRA, EIMSK, EIFR;
+
+enum { PB0, PB1, PB2, PB3, PB4, PB5, PB6, PB7 };
+enum { PD0, PD1, PD2, PD3, PD4, PD5, PD6, PD7 };
+enum { RXC0 = 7, UDRE0 = 5, U2X0 = 1,
+       RXCIE0 = 7, UDRIE0 = 5, RXEN0 = 4, TXEN0 = 3,
+       UCSZ01 = 2, UCSZ00 = 1,
+       ISC01 = 1, ISC00 = 0, INT0 = 0, INTF0 = 0 };
+
+#endif /* _HOSTSIM_AVR_IO_H_ */
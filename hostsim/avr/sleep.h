@@ -0,0 +1,16 @@
+/* $Id: hostsim/avr/sleep.h $
+ * Going to sleep is where gwsim.c gets control and plays the hardware.
+ */
+
+#ifndef _HOSTSIM_AVR_SLEEP_H_
+#define _HOSTSIM_AVR_SLEEP_H_
+
+void gwsim_sleep(void);
+
+#define SLEEP_MODE_IDLE 0
+#define set_sleep_mode(m)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu() gwsim_sleep()
+
+#endif /* _HOSTSIM_AVR_SLEEP_H_ */
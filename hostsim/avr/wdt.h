@@ -0,0 +1,8 @@
+/* $Id: hostsim/avr/wdt.h $ */
+
+#ifndef _HOSTSIM_AVR_WDT_H_
+#define _HOSTSIM_AVR_WDT_H_
+
+#define wdt_disable()
+
+#endif /* _HOSTSIM_AVR_WDT_H_ */
@@ -0,0 +1,10 @@
+/* $Id: hostsim/util/delay.h $
+ * Waiting is not simulated.
+ */
+
+#ifndef _HOSTSIM_UTIL_DELAY_H_
+#define _HOSTSIM_UTIL_DELAY_H_
+
+#define _delay_ms(ms)
+
+#endif /* _HOSTSIM_UTIL_DELAY_H_ */
@@ -0,0 +1,24 @@
+/* $Id: hostutil.c $
+ * Small helpers shared by the host tools.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "hostutil.h"
+
+int parsekey(const char * s, uint8_t * key)
+{
+  int i;
+  if (strlen(s) != 32) {
+    return 0;
+  }
+  for (i = 0; i < 16; i++) {
+    unsigned int b;
+    if (sscanf(&s[i * 2], "%2x", &b) != 1) {
+      return 0;
+    }
+    key[i] = b;
+  }
+  return 1;
+}
@@ -0,0 +1,12 @@
+/* $Id: hostutil.h $
+ * Small helpers shared by the host tools.
+ */
+
+#ifndef _HOSTUTIL_H_
+#define _HOSTUTIL_H_
+
+/* Parses a key for over-the-air config updates given as 32 hex digits
+ * into 16 bytes. Returns 1 on success. */
+int parsekey(const char * s, uint8_t * key);
+
+#endif /* _HOSTUTIL_H_ */
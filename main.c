@@ -14,9 +14,13 @@
 #include <util/delay.h>
 
 #include "adc.h"
+#include "crc.h"
 #include "eeprom.h"
+#include "frame.h"
+#include "ota.h"
+#include "provision.h"
 #include "rfm69.h"
-#include "sht4x.h"
+#include "sensors.h"
 
 /* We need to disable the watchdog very early, because it stays active
  * after a reset with a timeout of only 15 ms. */
@@ -33,74 +37,241 @@ uint16_t temp = 0;
 uint16_t hum = 0;
 /* Battery level. Range 0-255, 255 = our supply voltage = 3,3V */
 uint8_t batvolt = 0;
+/* Everything the sensors returned in the last measurement. temp and hum
+ * are taken from the first 4 bytes of this, the rest is appended to the
+ * frame as it is. */
+static struct sensorframe sensordata;
 /* How often did we send a packet? */
 uint32_t pktssent = 0;
+/* How often did we have to reset because the sensor could not be
+ * recovered? This is not initialized on startup, so it survives the
+ * watchdog reset (but not a power loss), with the inverted copy telling
+ * us whether it's valid. */
+uint16_t forcedresets __attribute__((section(".noinit")));
+uint16_t invforcedresets __attribute__((section(".noinit")));
 
 /* This is just a fallback value, in case we cannot read this from EEPROM
  * on Boot */
 uint8_t sensorid = 3; // 0 - 255 / 0xff
+/* More settings that can be changed through the EEPROM, with the same
+ * fallback behaviour. */
+/* Transmit interval, in multiples of the watchdog timer timeout (8s).
+ * 0 or 1 get added at random. */
+uint8_t txinterval = 3;
+/* Listen for a config update after every n-th transmission. 0 = never. */
+uint8_t rxevery = 64;
+/* Radio profile, see rfm69_setprofile(). 0xff = the compiled in one. */
+uint8_t radioprofile = 0xff;
+/* Calibration offsets, added to the raw values from the sensor */
+int16_t tempoffset = 0;
+int16_t humoffset = 0;
 
-/* The frame we're preparing to send. */
-static uint8_t frametosend[10];
+#ifdef DIAGSTATS
+/* Send the diagnostic counters with every n-th frame */
+#ifndef DIAGEVERY
+#define DIAGEVERY 64
+#endif /* DIAGEVERY not defined externally */
+#define DIAGLEN (1 + 2 * FRAME_DIAG_COUNTERS)
+#else /* DIAGSTATS */
+#define DIAGLEN 0
+#endif /* DIAGSTATS */
 
-static uint8_t calculatecrc(uint8_t * data, uint8_t len)
+/* The frame we're preparing to send: the classic frame, plus the byte
+ * announcing and the data of whatever additional sensors deliver, plus
+ * the diagnostic counters. */
+#define MAXFRAMELEN (FRAME_CLASSICLEN + 1 + SENSORS_MAXDATA - SENSORS_PRIMARYLEN + DIAGLEN)
+static uint8_t frametosend[MAXFRAMELEN];
+
+#ifdef DIAGSTATS
+/* Fills the diagnostic counters (see frame.h) into p, returns how many
+ * bytes that were. */
+static uint8_t preparediag(uint8_t * p)
 {
-  uint8_t i, j;
-  uint8_t res = 0;
-  for (j = 0; j < len; j++) {
-    uint8_t val = data[j];
-    for (i = 0; i < 8; i++) {
-      uint8_t tmp = (uint8_t)((res ^ val) & 0x80);
-      res <<= 1;
-      if (0 != tmp) {
-        res ^= 0x31;
-      }
-      val <<= 1;
-    }
+  uint16_t c[FRAME_DIAG_COUNTERS];
+  uint8_t i;
+  c[0] = forcedresets;
+  c[1] = sensors_recstats.retries;
+  c[2] = sensors_recstats.busclears;
+  c[3] = sensors_recstats.powercycles;
+  c[4] = sensors_recstats.failures;
+#ifdef RFM_LBT
+  c[5] = rfm69_lbtbusy;
+  c[6] = rfm69_lbtgaveup;
+#else /* RFM_LBT */
+  c[5] = 0;
+  c[6] = 0;
+#endif /* RFM_LBT */
+#ifdef OTACONFIG
+  c[7] = ota_windows;
+  c[8] = ota_accepted;
+  c[9] = ota_rejected;
+  c[10] = ota_rxpolls;
+#else /* OTACONFIG */
+  c[7] = 0;
+  c[8] = 0;
+  c[9] = 0;
+  c[10] = 0;
+#endif /* OTACONFIG */
+  p[0] = 2 * FRAME_DIAG_COUNTERS;
+  for (i = 0; i < FRAME_DIAG_COUNTERS; i++) {
+    p[1 + 2 * i] = (c[i] >> 8) & 0xff;
+    p[2 + 2 * i] = (c[i] >> 0) & 0xff;
   }
-  return res;
+  return DIAGLEN;
 }
+#endif /* DIAGSTATS */
 
 /* Fill the frame to send with out collected data and a CRC.
  * The protocol we use is that of a "CustomSensor" from the
  * FHEM LaCrosseItPlusReader sketch for the Jeelink.
  * So you'll just have to enable the support for CustomSensor in that sketch
  * and flash it onto a JeeNode and voila, you have your receiver.
- *
- * Byte  0: Startbyte (=0xCC)
- * Byte  1: Sensor-ID (0 - 255/0xff)
- * Byte  2: Number of data bytes that follow (6)
- * Byte  3: Sensortype (=0xf7 for FoxTemp)
- * Byte  4: temperature MSB (raw value from SHT31)
- * Byte  5: temperature LSB
- * Byte  6: humidity MSB (raw value from SHT31)
- * Byte  7: humidity LSB
- * Byte  8: Battery voltage
- * Byte  9: CRC
+ * See frame.h for the format. flags are FRAME_EXT_* flags without data
+ * that should be set in the frame. Returns the length of the frame.
  */
-void prepareframe(void)
+uint8_t prepareframe(uint8_t flags)
 {
+  uint8_t i;
+  uint8_t n = sensordata.len - SENSORS_PRIMARYLEN;
+  uint8_t ext = SENSORS_EXT | flags;
+  uint8_t pos = 9;
+#ifdef DIAGSTATS
+  if ((pktssent % DIAGEVERY) == 0) { /* including the first one after boot */
+    ext |= FRAME_EXT_DIAG;
+  }
+#endif /* DIAGSTATS */
   frametosend[ 0] = 0xCC;
   frametosend[ 1] = sensorid;
-  frametosend[ 2] = 6; /* 6 bytes of data follow (CRC not counted) */
   frametosend[ 3] = 0xf7; /* Sensor type: FoxTemp */
   frametosend[ 4] = (temp >> 8) & 0xff;
   frametosend[ 5] = (temp >> 0) & 0xff;
   frametosend[ 6] = (hum >> 8) & 0xff;
   frametosend[ 7] = (hum >> 0) & 0xff;
   frametosend[ 8] = batvolt;
-  frametosend[ 9] = calculatecrc(frametosend, 9);
+  if (ext != 0) {
+    frametosend[pos++] = ext;
+    for (i = 0; i < n; i++) {
+      frametosend[pos++] = sensordata.data[SENSORS_PRIMARYLEN + i];
+    }
+#ifdef DIAGSTATS
+    if (ext & FRAME_EXT_DIAG) {
+      pos += preparediag(&frametosend[pos]);
+    }
+#endif /* DIAGSTATS */
+  }
+  frametosend[ 2] = pos - 3; /* data bytes that follow (CRC not counted) */
+  frametosend[pos] = calculatecrc(frametosend, pos);
+  return pos + 1;
+}
+
+/* Loads a setting stored together with its inverted copy from EEPROM.
+ * val is left alone if the two do not match. */
+static void loadsetting(uint8_t * val, uint8_t * ee, uint8_t * eeinv)
+{
+  uint8_t e1 = eeprom_read_byte(ee);
+  uint8_t e2 = eeprom_read_byte(eeinv);
+  if ((e1 ^ 0xff) == e2) { /* OK, the 'checksum' matches. Use this */
+    *val = e1;
+  }
+}
+
+static void loadsetting16(int16_t * val, uint16_t * ee, uint16_t * eeinv)
+{
+  uint16_t e1 = eeprom_read_word(ee);
+  uint16_t e2 = eeprom_read_word(eeinv);
+  if ((e1 ^ 0xffff) == e2) {
+    *val = (int16_t)e1;
+  }
+}
+
+static void savesetting(uint8_t val, uint8_t * ee, uint8_t * eeinv)
+{
+  eeprom_update_byte(ee, val);
+  eeprom_update_byte(eeinv, val ^ 0xff);
+}
+
+static void savesetting16(int16_t val, uint16_t * ee, uint16_t * eeinv)
+{
+  eeprom_update_word(ee, (uint16_t)val);
+  eeprom_update_word(eeinv, (uint16_t)val ^ 0xffff);
 }
 
 void loadsettingsfromeeprom(void)
 {
-  uint8_t e1 = eeprom_read_byte(&ee_sensorid);
-  uint8_t e2 = eeprom_read_byte(&ee_invsensorid);
-  if ((e1 ^ 0xff) == e2) { /* OK, the 'checksum' matches. Use this as our ID */
-    sensorid = e1;
+  loadsetting(&sensorid, &ee.sensorid, &ee.invsensorid);
+  loadsetting(&txinterval, &ee.txinterval, &ee.invtxinterval);
+  loadsetting(&rxevery, &ee.rxevery, &ee.invrxevery);
+  loadsetting(&radioprofile, &ee.radioprofile, &ee.invradioprofile);
+  loadsetting16(&tempoffset, &ee.tempoffset, &ee.invtempoffset);
+  loadsetting16(&humoffset, &ee.humoffset, &ee.invhumoffset);
+  if (txinterval == 0) {
+    txinterval = 1;
   }
 }
 
+/* Store a config received through the serial port during boot. It is
+ * loaded from the EEPROM again afterwards. */
+static void saveprovconfig(struct provconfig * pc)
+{
+  savesetting(pc->sensorid, &ee.sensorid, &ee.invsensorid);
+  savesetting(pc->txinterval, &ee.txinterval, &ee.invtxinterval);
+  savesetting(pc->rxevery, &ee.rxevery, &ee.invrxevery);
+  savesetting(pc->radioprofile, &ee.radioprofile, &ee.invradioprofile);
+  savesetting16(pc->tempoffset, &ee.tempoffset, &ee.invtempoffset);
+  savesetting16(pc->humoffset, &ee.humoffset, &ee.invhumoffset);
+  if (pc->haskey) {
+    uint8_t oldkey[16];
+    uint8_t i;
+    eeprom_read_block(oldkey, ee.otakey, 16);
+    for (i = 0; i < 16; i++) {
+      if (oldkey[i] != pc->otakey[i]) {
+        break;
+      }
+    }
+    if (i < 16) {
+      /* A new key starts a new sequence of over-the-air updates. With the
+       * same key, the old sequence has to stay, or the updates sent so far
+       * could be replayed. */
+      eeprom_update_block(pc->otakey, ee.otakey, 16);
+      eeprom_update_word(&ee.otaseq, 0);
+      eeprom_update_word(&ee.invotaseq, 0xffff);
+    }
+  }
+}
+
+/* Adds a calibration offset to a raw value, without running into the
+ * 0xffff that marks errors (or wrapping around). */
+static uint16_t addoffset(uint16_t raw, int16_t offset)
+{
+  int32_t v = (int32_t)raw + offset;
+  if (v < 0) {
+    return 0;
+  }
+  if (v > 0xfffe) {
+    return 0xfffe;
+  }
+  return v;
+}
+
+#ifdef OTACONFIG
+/* Apply a config update received over the air, and make it permanent. */
+static void applyotaconfig(struct otaconfig * c)
+{
+  if (c->set & OTA_SET_SENSORID) {
+    sensorid = c->sensorid;
+    savesetting(sensorid, &ee.sensorid, &ee.invsensorid);
+  }
+  if (c->set & OTA_SET_TXINTERVAL) {
+    txinterval = c->txinterval;
+    savesetting(txinterval, &ee.txinterval, &ee.invtxinterval);
+  }
+  if (c->set & OTA_SET_RXEVERY) {
+    rxevery = c->rxevery;
+    savesetting(rxevery, &ee.rxevery, &ee.invrxevery);
+  }
+}
+#endif /* OTACONFIG */
+
 /* This is just to wake us up from sleep, it doesn't really do anything. */
 ISR(WDT_vect)
 {
@@ -114,16 +285,31 @@ int main(void)
   CLKPR = _BV(CLKPCE);
   CLKPR = _BV(CLKPS2) | _BV(CLKPS1);
   
-  _delay_ms(1000); /* Wait. */
+  /* Give the host a chance to provision us through the serial port.
+   * If it doesn't, this just waits about a second, like we always did. */
+  loadsettingsfromeeprom();
+  struct provconfig pc;
+  uint8_t provisioned = provision_window(sensorid, &pc);
+  if (provisioned) {
+    saveprovconfig(&pc);
+    loadsettingsfromeeprom();
+  }
+  provision_done(provisioned);
 
   rfm69_initport();
   adc_init();
-  sht4x_init();
-  loadsettingsfromeeprom();
+  sensors_init();
+  if ((forcedresets ^ 0xffff) != invforcedresets) { /* Power on, not valid */
+    forcedresets = 0;
+    invforcedresets = 0xffff;
+  }
   
   _delay_ms(1000); /* The RFM12 needs some time to start up */
   
   rfm69_initchip();
+  if (radioprofile != 0xff) {
+    rfm69_setprofile(radioprofile);
+  }
   rfm69_setsleep(1);
   
   /* Enable watchdog timer interrupt with a timeout of 8 seconds */
@@ -156,7 +342,7 @@ int main(void)
   /* All set up, enable interrupts and go. */
   sei();
 
-  sht4x_startmeas();
+  sensors_startmeas();
 
   uint16_t transmitinterval = 2; /* this is in multiples of the watchdog timer timeout (8S)! */
   uint8_t mlcnt = 0;
@@ -171,25 +357,32 @@ int main(void)
       adc_power(1);
       adc_start();
       /* Fetch values from PREVIOUS measurement */
-      struct sht4xdata hd;
-      sht4x_read(&hd);
+      sensors_read(&sensordata);
+      if (!(sensordata.valid & 0x01)) {
+        /* Try to get the sensor back. This takes some milliseconds,
+         * much less than the reset we would need otherwise. */
+        sensors_recover(&sensordata);
+      }
       temp = 0xffff;
       hum = 0xffff;
-      if (hd.valid) {
+      if (sensordata.valid & 0x01) { /* The primary SHT4x */
         readerrcnt = 0;
-        temp = hd.temp;
-        hum = hd.hum;
+        temp = addoffset((sensordata.data[0] << 8) | sensordata.data[1], tempoffset);
+        hum = addoffset((sensordata.data[2] << 8) | sensordata.data[3], humoffset);
       } else {
         readerrcnt++;
         if (readerrcnt > 5) {
-          /* We could not read the SHT31 5 times in a row?! */
-          /* Then force reset through watchdog timer. */
+          /* We could not read the SHT4x 5 times in a row, even with all
+           * the recovery attempts?! */
+          /* Then force reset through watchdog timer as a last resort. */
+          forcedresets++;
+          invforcedresets = forcedresets ^ 0xffff;
           while (1) {
             sleep_cpu();
           }
         }
       }
-      sht4x_startmeas();
+      sensors_startmeas();
       /* read voltage from ADC */
       uint16_t adcval = adc_read();
       adc_power(0);
@@ -201,12 +394,27 @@ int main(void)
        * pure accident our reported voltage values are exactly
        * compatible with foxtemp2016 without any conversion. */
       batvolt = adcval >> 2;
-      prepareframe();
-      rfm69_sendarray(frametosend, 10);
+#ifdef OTACONFIG
+      /* After every rxevery-th frame we listen for a config update. We
+       * tell the gateway in that frame, it only sends after those. */
+      uint8_t listen = (rxevery > 0) && (((pktssent + 1) % rxevery) == 0)
+                    && ota_haskey();
+      rfm69_sendarray(frametosend, prepareframe(listen ? FRAME_EXT_RXWINDOW : 0));
+#else /* OTACONFIG */
+      rfm69_sendarray(frametosend, prepareframe(0));
+#endif /* OTACONFIG */
       pktssent++;
+#ifdef OTACONFIG
+      if (listen) {
+        struct otaconfig oc;
+        if (ota_listen(sensorid, &oc)) {
+          applyotaconfig(&oc);
+        }
+      }
+#endif /* OTACONFIG */
       /* Semirandom delay: the lowest bits from the ADC are mostly noise, so
        * we use that */
-      transmitinterval = 3 + (adcval & 0x0001);
+      transmitinterval = txinterval + (adcval & 0x0001);
       rfm69_setsleep(1);
       mlcnt = 0;
     }
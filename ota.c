@@ -0,0 +1,103 @@
+/* $Id: ota.c $
+ * Over-the-air configuration updates, see ota.h for the frame format.
+ *
+ * Config frames are authenticated with a CBC-MAC using XTEA (xtea.c).
+ * Since all frames have the same length, a plain CBC-MAC is fine.
+ */
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <inttypes.h>
+#include "eeprom.h"
+#include "ota.h"
+#include "rfm69.h"
+#include "xtea.h"
+
+/* How long to listen, in checks of the radio status, each about 1.2 ms.
+ * The gateway waits 10 ms before it answers, and the frame itself takes
+ * another 12 ms at 17241 baud. */
+#ifndef OTA_RXPOLLS
+#define OTA_RXPOLLS 40
+#endif /* OTA_RXPOLLS not defined externally */
+
+uint16_t ota_windows = 0;
+uint16_t ota_accepted = 0;
+uint16_t ota_rejected = 0;
+uint16_t ota_rxpolls = 0;
+
+static uint32_t ota_getu32(uint8_t * p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+       | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* Reads the key from the EEPROM into kb. Returns 1 if one is set. */
+static uint8_t ota_readkey(uint8_t * kb)
+{
+  uint8_t i;
+  uint8_t haskey = 0;
+  eeprom_read_block(kb, ee.otakey, 16);
+  for (i = 0; i < 16; i++) {
+    if (kb[i] != 0xff) {
+      haskey = 1;
+    }
+  }
+  return haskey;
+}
+
+uint8_t ota_haskey(void)
+{
+  uint8_t kb[16];
+  return ota_readkey(kb);
+}
+
+uint8_t ota_listen(uint8_t sensorid, struct otaconfig * c)
+{
+  uint8_t kb[16];
+  uint8_t f[OTA_FRAMELEN];
+  if (!ota_readkey(kb)) {
+    return 0;
+  }
+  ota_windows++;
+  uint8_t polls = OTA_RXPOLLS;
+  uint8_t found = 0;
+  rfm69_startreceive(OTA_FRAMELEN);
+  /* Frames of other sensors (or config frames for them) have the same
+   * sync word and may arrive before ours, so skip them and keep
+   * listening for the rest of the window. */
+  while (rfm69_pollarray(f, OTA_FRAMELEN, &polls)) {
+    if ((f[0] == 0xCD) && ((f[1] == sensorid) || (f[1] == 0xff))) {
+      found = 1;
+      break;
+    }
+  }
+  rfm69_setreceiver(0);
+  ota_rxpolls += OTA_RXPOLLS - polls;
+  if (!found) {
+    return 0;
+  }
+  uint16_t seq = (f[2] << 8) | f[3];
+  uint16_t lastseq = eeprom_read_word(&ee.otaseq);
+  if ((lastseq ^ 0xffff) != eeprom_read_word(&ee.invotaseq)) {
+    lastseq = 0;
+  }
+  if ((seq <= lastseq)
+   || (xtea_cbcmac(f, OTA_FRAMELEN - 4, kb) != ota_getu32(&f[OTA_FRAMELEN - 4]))) {
+    ota_rejected++;
+    return 0;
+  }
+  eeprom_update_word(&ee.otaseq, seq);
+  eeprom_update_word(&ee.invotaseq, seq ^ 0xffff);
+  c->set = f[4];
+  if (f[1] == 0xff) { /* Never give all sensors the same ID */
+    c->set &= (uint8_t)~OTA_SET_SENSORID;
+  }
+  if (f[6] == 0) {
+    c->set &= (uint8_t)~OTA_SET_TXINTERVAL;
+  }
+  c->sensorid = f[5];
+  c->txinterval = f[6];
+  c->rxevery = f[7];
+  ota_accepted++;
+  return 1;
+}
@@ -0,0 +1,57 @@
+/* $Id: ota.h $
+ * Over-the-air configuration updates: After every n-th transmission, the
+ * sensor listens for a short time for a config frame from the gateway.
+ *
+ * Format of the config frame:
+ * Byte  0: Startbyte (=0xCD)
+ * Byte  1: Sensor-ID this is for (0xff = all, the ID itself is then
+ *          never changed)
+ * Byte  2: Sequence number MSB
+ * Byte  3: Sequence number LSB. Has to be larger than the one of the last
+ *          update we accepted, so old frames cannot be replayed.
+ * Byte  4: Which of the following settings to change (OTA_SET_* bitmask)
+ * Byte  5: New Sensor-ID
+ * Byte  6: New transmit interval, in multiples of 8 seconds (>= 1)
+ * Byte  7: New "open a config window after every n-th transmission"
+ *          (0 = never, that cannot be undone over the air!)
+ * Byte  8 to 15: reserved, 0
+ *          (The radio profile cannot be changed over the air: a sensor
+ *          sending on a datarate its gateway does not use could not be
+ *          reached anymore to undo that. Use provisioning for it.)
+ * Byte 16 to 19: MAC: the first 4 bytes of a XTEA-CBC-MAC over bytes 0
+ *          to 15, with the key from the EEPROM.
+ */
+
+#ifndef _OTA_H_
+#define _OTA_H_
+
+#define OTA_FRAMELEN 20
+
+#define OTA_SET_SENSORID     0x01
+#define OTA_SET_TXINTERVAL   0x02
+#define OTA_SET_RXEVERY      0x04
+
+struct otaconfig {
+  uint8_t set; /* OTA_SET_* bitmask: which of the following are valid */
+  uint8_t sensorid;
+  uint8_t txinterval;
+  uint8_t rxevery;
+};
+
+/* Statistics */
+extern uint16_t ota_windows;  /* how often did we listen */
+extern uint16_t ota_accepted; /* how many config frames did we accept */
+extern uint16_t ota_rejected; /* how many were for us but had a bad MAC or
+                                 an old sequence number */
+extern uint16_t ota_rxpolls;  /* how often did we check the radio while
+                                 listening, each about 1.2 ms */
+
+/* Returns 1 if a key is set, i.e. if over-the-air updates are enabled. */
+uint8_t ota_haskey(void);
+
+/* Listens for a config frame for sensor ID sensorid. Does not even turn on
+ * the receiver if no key is set. Returns 1 if a valid config update was
+ * received, which is then in c. */
+uint8_t ota_listen(uint8_t sensorid, struct otaconfig * c);
+
+#endif /* _OTA_H_ */
@@ -0,0 +1,124 @@
+/* $Id: provision.c $
+ * Provisioning over the serial port, see provision.h for the protocol.
+ *
+ * We are already running at our 250 kHz CPU clock when this runs, so
+ * the only sensible baudrate is 2400 (with U2X, 0.2% error). A config
+ * block takes about 125 ms at that speed.
+ */
+
+#include <avr/io.h>
+#include <inttypes.h>
+#include <util/crc16.h>
+#include <util/delay.h>
+#include "provision.h"
+
+#define PROV_BAUDRATE 2400UL
+/* How long we wait for the first byte, and then between bytes, in ms */
+#define PROV_WINDOWMS 1000
+#define PROV_BYTETIMEOUTMS 50
+/* Give up after this many bytes that are not part of a valid block, so
+ * noise on a floating RX line cannot keep us from booting. */
+#define PROV_MAXJUNK 100
+
+static void provision_putc(uint8_t c)
+{
+  while (!(UCSR0A & _BV(UDRE0))) { }
+  UDR0 = c;
+}
+
+/* Waits up to timeout ms for a byte. Returns -1 if none came. */
+static int16_t provision_getc(uint16_t timeout)
+{
+  while (timeout-- > 0) {
+    if (UCSR0A & _BV(RXC0)) {
+      return UDR0;
+    }
+    _delay_ms(1);
+  }
+  return -1;
+}
+
+uint8_t provision_window(uint8_t sensorid, struct provconfig * pc)
+{
+  uint8_t buf[PROV_BLOCKLEN];
+  uint8_t i;
+  uint8_t junk = 0;
+  PRR &= (uint8_t)~_BV(PRUSART0);
+  UBRR0 = ((F_CPU + 4 * PROV_BAUDRATE) / (8 * PROV_BAUDRATE)) - 1;
+  UCSR0A = _BV(U2X0);
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00); /* 8N1 */
+  UCSR0B = _BV(RXEN0) | _BV(TXEN0);
+  provision_putc('F');
+  provision_putc('T');
+  provision_putc('?');
+  provision_putc(PROV_VERSION);
+  provision_putc(sensorid);
+  while (1) {
+    /* Wait for the start of a block, ignoring anything else */
+    int16_t c = provision_getc(PROV_WINDOWMS);
+    if (c < 0) {
+      return 0;
+    }
+    if (c != 'F') {
+      if (++junk > PROV_MAXJUNK) {
+        return 0;
+      }
+      continue;
+    }
+    buf[0] = c;
+    /* The length of the block follows from byte 3 */
+    uint8_t len = 4;
+    for (i = 1; i < len; i++) {
+      c = provision_getc(PROV_BYTETIMEOUTMS);
+      if (c < 0) {
+        break;
+      }
+      buf[i] = c;
+      if (i == 3) {
+        if ((c != PROV_FIELDSLEN) && (c != PROV_FIELDSLEN_NOKEY)) {
+          break;
+        }
+        len = 4 + c + 2;
+      }
+    }
+    uint16_t crc = 0xffff;
+    uint8_t j;
+    for (j = 0; j < (len - 2); j++) {
+      crc = _crc_ccitt_update(crc, buf[j]);
+    }
+    if ((len == 4) || (i < len) || (buf[1] != 'T') || (buf[2] != PROV_VERSION)
+     || (crc != ((buf[len - 2] << 8) | buf[len - 1]))) {
+      provision_putc('E');
+      junk += i;
+      if (junk > PROV_MAXJUNK) {
+        return 0;
+      }
+      continue;
+    }
+    pc->sensorid = buf[4];
+    pc->txinterval = buf[5];
+    pc->rxevery = buf[6];
+    pc->radioprofile = buf[7];
+    pc->tempoffset = (int16_t)((buf[8] << 8) | buf[9]);
+    pc->humoffset = (int16_t)((buf[10] << 8) | buf[11]);
+    pc->haskey = (buf[3] == PROV_FIELDSLEN);
+    if (pc->haskey) {
+      for (j = 0; j < 16; j++) {
+        pc->otakey[j] = buf[12 + j];
+      }
+    }
+    return 1;
+  }
+}
+
+void provision_done(uint8_t ok)
+{
+  if (ok) {
+    provision_putc('K');
+  }
+  /* Wait for the last byte to be sent out, then turn the USART off. */
+  while (!(UCSR0A & _BV(UDRE0))) { }
+  _delay_ms(10);
+  UCSR0B = 0;
+  PRR |= _BV(PRUSART0);
+}
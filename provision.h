@@ -0,0 +1,60 @@
+/* $Id: provision.h $
+ * Provisioning over the serial port: Right after booting, the sensor
+ * gives the host a short time to send it a config block, which replaces
+ * the old way of flashing a separate program just to write the EEPROM.
+ *
+ * The sensor announces the window by sending 'F' 'T' '?', the version of
+ * the block it understands, and its current sensor ID.
+ * The config block the host sends then looks like this:
+ * Byte  0: 'F'
+ * Byte  1: 'T'
+ * Byte  2: Version (=1)
+ * Byte  3: Number of bytes that follow before the CRC (n): 24, or 8 to
+ *          leave the stored key alone (then the block ends after byte 11)
+ * Byte  4: Sensor-ID
+ * Byte  5: Transmit interval, in multiples of 8 seconds (>= 1)
+ * Byte  6: Listen for config updates after every n-th transmission
+ * Byte  7: Radio profile (see rfm69_setprofile(), 0xff = compiled in one)
+ * Byte  8: Temperature offset MSB (signed, in raw sensor units)
+ * Byte  9: Temperature offset LSB
+ * Byte 10: Humidity offset MSB (signed, in raw sensor units)
+ * Byte 11: Humidity offset LSB
+ * Byte 12 to 27: key for over-the-air config updates, all 0xff = none
+ * Byte 4+n: CRC MSB (CRC-CCITT as in avr-libcs _crc_ccitt_update, start
+ * Byte 5+n: CRC LSB  value 0xffff, over bytes 0 to 3+n)
+ * Setting the same key again keeps the sequence number of over-the-air
+ * updates, so old updates cannot be replayed; a different key resets it.
+ * The sensor answers with 'K' once the config is stored, or with 'E' if
+ * the block was broken, in which case the host may send it again.
+ */
+
+#ifndef _PROVISION_H_
+#define _PROVISION_H_
+
+#define PROV_VERSION 1
+#define PROV_FIELDSLEN 24
+#define PROV_FIELDSLEN_NOKEY 8
+/* Longest block, the one with a key */
+#define PROV_BLOCKLEN (4 + PROV_FIELDSLEN + 2)
+
+struct provconfig {
+  uint8_t sensorid;
+  uint8_t txinterval;
+  uint8_t rxevery;
+  uint8_t radioprofile;
+  int16_t tempoffset;
+  int16_t humoffset;
+  uint8_t haskey;     /* 0 = keep the stored key, otakey is not set */
+  uint8_t otakey[16];
+};
+
+/* Opens the provisioning window, which takes about 1 second if the host
+ * does not send anything. Returns 1 if a valid config block was received
+ * into pc. */
+uint8_t provision_window(uint8_t sensorid, struct provconfig * pc);
+
+/* Closes the window: Tells the host whether the config was stored (ok),
+ * and turns off the USART again. */
+void provision_done(uint8_t ok);
+
+#endif /* _PROVISION_H_ */
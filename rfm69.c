@@ -7,6 +7,7 @@
 
 #include <avr/io.h>
 #include <math.h>
+#include <util/delay.h>
 #include "rfm69.h"
 
 /* Pin mappings for Moteino / Canique MK2:
@@ -31,8 +32,36 @@
 #define RFM_DATARATE 17241.0
 #endif /* RFM_DATARATE not defined externally */
 
+/* RegRssiThresh. This is the raw register value, the threshold in dBm is
+ * -value / 2. 220 = -110 dBm is what we use for receiving. */
+#ifndef RFM_RSSITHRESH
+#define RFM_RSSITHRESH 220
+#endif /* RFM_RSSITHRESH not defined externally */
+/* For listen-before-talk, -110 dBm is too close to the noise floor, the
+ * channel would nearly always look busy. So while checking the channel,
+ * we use something less sensitive. */
+#ifndef RFM_LBT_RSSITHRESH
+#define RFM_LBT_RSSITHRESH 190
+#endif /* RFM_LBT_RSSITHRESH not defined externally */
+
+/* Listen before talk: how often do we check the channel before we give
+ * up and send anyways, and the maximum backoff between tries in ms
+ * (must be a power of 2). */
+#ifndef RFM_LBT_MAXTRIES
+#define RFM_LBT_MAXTRIES 5
+#endif /* RFM_LBT_MAXTRIES not defined externally */
+#ifndef RFM_LBT_MAXBACKOFF
+#define RFM_LBT_MAXBACKOFF 16
+#endif /* RFM_LBT_MAXBACKOFF not defined externally */
+
 #define PAYLOADSIZE 64
 
+#ifdef RFM_LBT
+/* Statistics for listen before talk */
+uint16_t rfm69_lbtbusy = 0;   /* How often was the channel found busy */
+uint16_t rfm69_lbtgaveup = 0; /* How often did we send despite a busy channel */
+#endif /* RFM_LBT */
+
 /* Note: Internal use only. Does not set the SS pin, the calling function
  * has to do that! */
 static uint8_t rfm69_spi8(uint8_t value) {
@@ -77,6 +106,16 @@ void rfm69_settransmitter(uint8_t e) {
   }
 }
 
+void rfm69_setreceiver(uint8_t e) {
+  if (e) {
+    /* RegOpMode => RECEIVE */
+    rfm69_writereg(0x01, (rfm69_readreg(0x01) & 0xE3) | 0x10);
+  } else {
+    /* RegOpMode => STANDBY */
+    rfm69_writereg(0x01, (rfm69_readreg(0x01) & 0xE3) | 0x04);
+  }
+}
+
 void rfm69_setsleep(uint8_t s) {
   if (s) {
     /* RegOpMode => SLEEP */
@@ -109,7 +148,56 @@ void rfm69_sendbyte(uint8_t data) {
   rfm69_spi16(0xB800 | data);
 }
 
+#ifdef RFM_LBT
+/* Listen before talk: Briefly turn on the receiver and check whether
+ * someone else is transmitting, by looking at the Rssi flag in
+ * RegIrqFlags1, which the RFM69 sets when the signal strength exceeds
+ * RegRssiThresh. If the channel is busy, wait a short random time and
+ * try again. Returns after the channel was found free, or after
+ * RFM_LBT_MAXTRIES tries. RegRssiThresh is raised to RFM_LBT_RSSITHRESH
+ * only for that, receiving keeps using RFM_RSSITHRESH.
+ * Note that at our 250 kHz CPU clock every register access takes about
+ * 1 ms, so one try keeps the receiver on for roughly 4 ms. */
+static void rfm69_waitforfreechannel(void) {
+  uint8_t tries;
+  rfm69_writereg(0x29, RFM_LBT_RSSITHRESH);
+  for (tries = 0; tries < RFM_LBT_MAXTRIES; tries++) {
+    rfm69_setreceiver(1);
+    /* Wait for RxReady in RegIrqFlags1. The RSSI has been sampled by
+     * the time our next register read completes. */
+    uint8_t maxreps = 100;
+    while (!(rfm69_readreg(0x27) & 0x40)) {
+      maxreps--;
+      if (maxreps == 0) { /* Give up */
+        break;
+      }
+    }
+    uint8_t busy = rfm69_readreg(0x27) & 0x08;
+    /* The lowest bits of the RSSI are mostly noise, we use them as our
+     * source of randomness for the backoff. */
+    uint8_t rnd = rfm69_readrssi();
+    rfm69_setreceiver(0);
+    if (!busy) {
+      break;
+    }
+    rfm69_lbtbusy++;
+    uint8_t backoff = 1 + (rnd & (RFM_LBT_MAXBACKOFF - 1));
+    while (backoff-- > 0) {
+      _delay_ms(1);
+    }
+  }
+  if (tries == RFM_LBT_MAXTRIES) {
+    rfm69_lbtgaveup++;
+  }
+  rfm69_writereg(0x29, RFM_RSSITHRESH);
+}
+#endif /* RFM_LBT */
+
 void rfm69_sendarray(uint8_t * data, uint8_t length) {
+#ifdef RFM_LBT
+  /* This needs to happen before we fill the FIFO, as receiving uses it. */
+  rfm69_waitforfreechannel();
+#endif /* RFM_LBT */
   /* Set the length of our payload */
   rfm69_writereg(0x38, length);
   rfm69_clearfifo(); /* Clear the FIFO */
@@ -136,6 +224,49 @@ void rfm69_sendarray(uint8_t * data, uint8_t length) {
   rfm69_settransmitter(0);
 }
 
+/* Returns the raw value of RegRssiValue. The signal strength in dBm is
+ * -value / 2. */
+uint8_t rfm69_readrssi(void) {
+  return rfm69_readreg(0x24);
+}
+
+void rfm69_readfifo(uint8_t * data, uint8_t length) {
+  /* Same as in sendarray: RegFifo is read in one go with SS held low. */
+  RFMPORT &= (uint8_t)~_BV(RFMPIN_SS);
+  rfm69_spi8(0x00); /* Select RegFifo (0x00) for reading */
+  for (int i = 0; i < length; i++) {
+    data[i] = rfm69_spi8(0x00);
+  }
+  RFMPORT |= _BV(RFMPIN_SS);
+}
+
+/* Turn on the receiver for frames of the given length. Fetch them with
+ * rfm69_pollarray(), and turn it off with rfm69_setreceiver(0). */
+void rfm69_startreceive(uint8_t length) {
+  rfm69_writereg(0x38, length);
+  rfm69_clearfifo();
+  rfm69_setreceiver(1);
+}
+
+/* Wait for a frame, checking RegIrqFlags2 at most *polls times, which at
+ * the 250 kHz CPU clock of the sensor take about 1.2 ms each. *polls is
+ * decreased by the checks used. Returns 1 if a frame was read into data.
+ * The receiver is then restarted right away, so this can be called again
+ * for the next frame. */
+uint8_t rfm69_pollarray(uint8_t * data, uint8_t length, uint8_t * polls) {
+  while (*polls > 0) {
+    (*polls)--;
+    if (rfm69_readreg(0x28) & 0x04) { /* PayloadReady */
+      rfm69_readfifo(data, length);
+      rfm69_clearfifo();
+      /* RegPacketConfig2 -> same as in initchip, plus RestartRx */
+      rfm69_writereg(0x3D, 0x16);
+      return 1;
+    }
+  }
+  return 0;
+}
+
 void rfm69_initport(void) {
   /* Configure Pins for output / input */
   RFMDDR |= _BV(RFMPIN_MOSI);
@@ -172,8 +303,8 @@ void rfm69_initchip(void) {
   /* RegIrqFlags2 (0x28): some status flags, writing a 1 to FIFOOVERRUN bit
    * clears the FIFO. This is what clearfifo() does. */
   rfm69_clearfifo();
-  /* RegRssiThresh -> 220 */
-  rfm69_writereg(0x29, 220);
+  /* RegRssiThresh -> 220 by default, see above */
+  rfm69_writereg(0x29, RFM_RSSITHRESH);
   /* RegPreambleMsb / Lsb - we want 3 bytes of preamble (0xAA) */
   rfm69_writereg(0x2C, 0x00);
   rfm69_writereg(0x2D, 0x03);
@@ -217,3 +348,36 @@ void rfm69_initchip(void) {
 
   rfm69_clearfifo();
 }
+
+/* Select one of the radio profiles that can be changed at runtime.
+ * Currently this only selects the datarate: 0 = 17241, 1 = 9579, anything
+ * else (0xff) = the compiled in RFM_DATARATE.
+ * Has to be called after rfm69_initchip(). */
+void rfm69_setprofile(uint8_t p) {
+  uint16_t dr;
+  if (p == 0) {
+    dr = (uint16_t)round(32000000.0 / 17241.0);
+  } else if (p == 1) {
+    dr = (uint16_t)round(32000000.0 / 9579.0);
+  } else {
+    dr = (uint16_t)round(32000000.0 / RFM_DATARATE);
+  }
+  rfm69_writereg(0x03, (dr >> 8));
+  rfm69_writereg(0x04, (dr & 0xff));
+}
+
+/* Additional setup for running as a receiver. Has to be called after
+ * rfm69_initchip(). length is the fixed payload length we expect. */
+void rfm69_initreceiver(uint8_t length) {
+  /* RegDioMapping1 -> DIO0 = 01, which in RX mode is PayloadReady. */
+  rfm69_writereg(0x25, 0x40);
+  /* RegPayloadLength -> fixed length packets of the size we expect */
+  rfm69_writereg(0x38, length);
+  /* RegRxBw was set up in initchip already. */
+  /* RegAfcFei -> AfcAutoOn=0: no AFC, the sensors are close enough. */
+  rfm69_writereg(0x1E, 0x00);
+  /* RegTestDagc -> 0x30, improved margin, recommended by the datasheet
+   * for AfcLowBetaOn=0 */
+  rfm69_writereg(0x6F, 0x30);
+  rfm69_clearfifo();
+}
@@ -12,5 +12,20 @@ void rfm69_settransmitter(uint8_t e);
 void rfm69_sendbyte(uint8_t data);
 void rfm69_sendarray(uint8_t * data, uint8_t length);
 void rfm69_setsleep(uint8_t s);
+void rfm69_setprofile(uint8_t p);
+void rfm69_startreceive(uint8_t length);
+uint8_t rfm69_pollarray(uint8_t * data, uint8_t length, uint8_t * polls);
+
+#ifdef RFM_LBT
+/* Statistics for listen before talk */
+extern uint16_t rfm69_lbtbusy;
+extern uint16_t rfm69_lbtgaveup;
+#endif /* RFM_LBT */
+
+/* Receiver side, used by the gateway firmware. */
+void rfm69_initreceiver(uint8_t length);
+void rfm69_setreceiver(uint8_t e);
+uint8_t rfm69_readrssi(void);
+void rfm69_readfifo(uint8_t * data, uint8_t length);
 
 #endif /* _RFM69_H_ */
@@ -0,0 +1,146 @@
+/* $Id: sensors.c $
+ * Registry of all sensors on the (bitbanged) I2C bus.
+ *
+ * All sensors share the bus and the power supplied through the I/O pins,
+ * so all of them are started and read in one go while we are awake anyways.
+ * To add a new type of sensor, write a driver with a startmeas and a read
+ * function like sht4x.c, add two small wrappers below and an entry in
+ * the registry, and account for its data in sensors.h.
+ */
+
+#include <avr/io.h>
+#include <inttypes.h>
+#include <util/delay.h>
+#include "bbtwi.h"
+#include "bh1750.h"
+#include "sensors.h"
+#include "sht4x.h"
+
+struct sensordriver {
+  uint8_t addr;    /* 7 bit I2C address */
+  uint8_t datalen; /* number of bytes this sensor adds to the frame */
+  void (* startmeas)(uint8_t addr);
+  /* Fills datalen bytes into buf. Returns 1 if the values are valid. */
+  uint8_t (* read)(uint8_t addr, uint8_t * buf);
+};
+
+static uint8_t sensors_readsht4x(uint8_t addr, uint8_t * buf)
+{
+  struct sht4xdata hd;
+  sht4x_read(addr, &hd);
+  buf[0] = (hd.temp >> 8) & 0xff;
+  buf[1] = (hd.temp >> 0) & 0xff;
+  buf[2] = (hd.hum >> 8) & 0xff;
+  buf[3] = (hd.hum >> 0) & 0xff;
+  return hd.valid;
+}
+
+#ifdef SENSOR_BH1750
+static uint8_t sensors_readbh1750(uint8_t addr, uint8_t * buf)
+{
+  uint16_t raw;
+  uint8_t res = bh1750_read(addr, &raw);
+  buf[0] = (raw >> 8) & 0xff;
+  buf[1] = (raw >> 0) & 0xff;
+  return res;
+}
+#endif /* SENSOR_BH1750 */
+
+static const struct sensordriver sensors[] = {
+  { SHT4X_ADDR_A, SENSORS_PRIMARYLEN, sht4x_startmeas, sensors_readsht4x },
+#ifdef SENSOR_SHT4X_B
+  { SHT4X_ADDR_B, SENSORS_LEN_SHT4X_B, sht4x_startmeas, sensors_readsht4x },
+#endif /* SENSOR_SHT4X_B */
+#ifdef SENSOR_BH1750
+  { BH1750_ADDR_L, SENSORS_LEN_BH1750, bh1750_startmeas, sensors_readbh1750 },
+#endif /* SENSOR_BH1750 */
+};
+
+#define NUMSENSORS (sizeof(sensors) / sizeof(sensors[0]))
+
+/* How long (in ms) to wait for a measurement of the primary SHT4x during
+ * recovery. It needs max. 8.3 ms in high precision mode. */
+#define SENSORS_MEASTIME 10
+
+struct sensorsrecstats sensors_recstats;
+
+void sensors_init(void)
+{
+  bbtwi_init();
+  /* None of the supported sensors need any further initialization. */
+}
+
+void sensors_startmeas(void)
+{
+  uint8_t i;
+  for (i = 0; i < NUMSENSORS; i++) {
+    sensors[i].startmeas(sensors[i].addr);
+  }
+}
+
+void sensors_read(struct sensorframe * f)
+{
+  uint8_t i, j;
+  f->len = 0;
+  f->valid = 0;
+  for (i = 0; i < NUMSENSORS; i++) {
+    uint8_t * p = &f->data[f->len];
+    if (sensors[i].read(sensors[i].addr, p)) {
+      f->valid |= (1 << i);
+    } else {
+      for (j = 0; j < sensors[i].datalen; j++) {
+        p[j] = 0xff;
+      }
+    }
+    f->len += sensors[i].datalen;
+  }
+}
+
+/* Restart the measurement of the primary sensor, wait, and read the
+ * result into its part of f. The other sensors are left alone: they
+ * might need much longer for a measurement than we wait here, and
+ * already have their values in f anyways.
+ * Returns 1 if the primary sensor could be read. */
+static uint8_t sensors_retry(struct sensorframe * f, uint8_t waitms)
+{
+  uint8_t j;
+  sensors[0].startmeas(sensors[0].addr);
+  while (waitms-- > 0) {
+    _delay_ms(1);
+  }
+  if (sensors[0].read(sensors[0].addr, f->data)) {
+    f->valid |= 0x01;
+    return 1;
+  }
+  for (j = 0; j < sensors[0].datalen; j++) {
+    f->data[j] = 0xff;
+  }
+  return 0;
+}
+
+uint8_t sensors_recover(struct sensorframe * f)
+{
+  /* Step 1: maybe the sensor just missed our measurement command. */
+  sensors_recstats.retries++;
+  if (sensors_retry(f, SENSORS_MEASTIME)) {
+    return 1;
+  }
+  /* Step 2: a sensor might be stuck holding SDA. */
+  sensors_recstats.busclears++;
+  bbtwi_busclear();
+  if (sensors_retry(f, 2 * SENSORS_MEASTIME)) {
+    return 1;
+  }
+  /* Step 3: power cycle all sensors. The SHT4x needs max. 1 ms after
+   * powerup before it accepts commands. */
+  sensors_recstats.powercycles++;
+  bbtwi_power(0);
+  _delay_ms(10);
+  bbtwi_power(1);
+  _delay_ms(2);
+  if (sensors_retry(f, 4 * SENSORS_MEASTIME)) {
+    return 1;
+  }
+  sensors_recstats.failures++;
+  return 0;
+}
@@ -0,0 +1,77 @@
+/* $Id: sensors.h $
+ * Registry of all sensors on the (bitbanged) I2C bus.
+ *
+ * The first sensor is always the SHT4x at 0x44, which delivers the
+ * temperature and humidity of the classic FoxTemp frame. Additional
+ * sensors are enabled at compile time through defines:
+ *  -DSENSOR_SHT4X_B   a second SHT4x at 0x45 (4 more bytes)
+ *  -DSENSOR_BH1750    a BH1750 light sensor at 0x23 (2 more bytes)
+ */
+
+#ifndef _SENSORS_H_
+#define _SENSORS_H_
+
+#include "frame.h"
+
+/* The data of the primary SHT4x */
+#define SENSORS_PRIMARYLEN 4
+
+/* For every additional sensor: how many bytes it adds to the frame, and
+ * how that is announced in the frame (see frame.h). The order of the
+ * registry in sensors.c has to match the order of the bits there. */
+#ifdef SENSOR_SHT4X_B
+#define SENSORS_LEN_SHT4X_B 4
+#define SENSORS_EXT_SHT4X_B FRAME_EXT_SHT4X_B
+#else /* SENSOR_SHT4X_B */
+#define SENSORS_LEN_SHT4X_B 0
+#define SENSORS_EXT_SHT4X_B 0
+#endif /* SENSOR_SHT4X_B */
+#ifdef SENSOR_BH1750
+#define SENSORS_LEN_BH1750 2
+#define SENSORS_EXT_BH1750 FRAME_EXT_BH1750
+#else /* SENSOR_BH1750 */
+#define SENSORS_LEN_BH1750 0
+#define SENSORS_EXT_BH1750 0
+#endif /* SENSOR_BH1750 */
+
+/* What the additional sensors add to the frame, FRAME_EXT_* bitmask */
+#define SENSORS_EXT (SENSORS_EXT_SHT4X_B | SENSORS_EXT_BH1750)
+
+/* Maximum number of bytes of measurement data all sensors together deliver */
+#define SENSORS_MAXDATA (SENSORS_PRIMARYLEN + SENSORS_LEN_SHT4X_B + SENSORS_LEN_BH1750)
+
+/* The results of all sensors. Each sensor appends its data in the order
+ * of the registry, all values MSB first. A sensor that could not be read
+ * fills its part with 0xff. */
+struct sensorframe {
+  uint8_t len;   /* number of bytes used in data */
+  uint8_t valid; /* bit n set if sensor n was read successfully */
+  uint8_t data[SENSORS_MAXDATA];
+};
+
+/* How often each step of sensors_recover() was needed */
+struct sensorsrecstats {
+  uint16_t retries;     /* measurement restarted */
+  uint16_t busclears;   /* bus freed with bbtwi_busclear() */
+  uint16_t powercycles; /* sensors powered off and on again */
+  uint16_t failures;    /* nothing helped */
+};
+extern struct sensorsrecstats sensors_recstats;
+
+/* Initialize the I2C bus and all sensors */
+void sensors_init(void);
+
+/* Start a measurement on all sensors */
+void sensors_startmeas(void);
+
+/* Read the results of the previous measurement from all sensors. */
+void sensors_read(struct sensorframe * f);
+
+/* Try to get the primary sensor working again after it could not be read,
+ * with increasingly drastic measures. After every step, a new measurement
+ * of the primary sensor is started and read back into f; the data of the
+ * other sensors in f is kept. Takes well below a second.
+ * Returns 1 if the primary sensor could be read again. */
+uint8_t sensors_recover(struct sensorframe * f);
+
+#endif /* _SENSORS_H_ */
@@ -11,14 +11,17 @@ struct sht4xdata {
   uint8_t valid;
 };
 
-/* Initialize (software-)I2C and sht4x */
-void sht4x_init(void);
+/* The I2C addresses the SHT4x variants can have.
+ * (The SHT4x needs no initialization, its powerup-default-config
+ * should be fine for us. The bus is initialized by bbtwi_init().) */
+#define SHT4X_ADDR_A 0x44
+#define SHT4X_ADDR_B 0x45
 
-/* Start measurement */
-void sht4x_startmeas(void);
+/* Start measurement on the sensor at I2C address addr */
+void sht4x_startmeas(uint8_t addr);
 
 /* Read result of measurement. Needs to be called no earlier than 15 ms
  * after starting. */
-void sht4x_read(struct sht4xdata * d);
+void sht4x_read(uint8_t addr, struct sht4xdata * d);
 
 #endif /* _SHT4X_H_ */
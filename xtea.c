@@ -0,0 +1,45 @@
+/* $Id: xtea.c $
+ * XTEA, used to authenticate over-the-air config updates (see ota.h).
+ * XTEA is small and fast enough even at the 250 kHz clock of the sensor.
+ * This is shared between the sensor firmware and the host tools.
+ */
+
+#include <inttypes.h>
+#include "xtea.h"
+
+static uint32_t xtea_getu32(uint8_t * p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+       | ((uint32_t)p[2] << 8) | p[3];
+}
+
+void xtea_encipher(uint32_t * v, uint32_t * k)
+{
+  uint32_t v0 = v[0];
+  uint32_t v1 = v[1];
+  uint32_t sum = 0;
+  uint8_t i;
+  for (i = 0; i < 32; i++) {
+    v0 += (((v1 << 4) ^ (v1 >> 5)) + v1) ^ (sum + k[sum & 3]);
+    sum += 0x9E3779B9;
+    v1 += (((v0 << 4) ^ (v0 >> 5)) + v0) ^ (sum + k[(sum >> 11) & 3]);
+  }
+  v[0] = v0;
+  v[1] = v1;
+}
+
+uint32_t xtea_cbcmac(uint8_t * data, uint8_t len, uint8_t * key)
+{
+  uint32_t k[4];
+  uint32_t v[2] = { 0, 0 };
+  uint8_t i;
+  for (i = 0; i < 4; i++) {
+    k[i] = xtea_getu32(&key[i * 4]);
+  }
+  for (i = 0; i < len; i += 8) {
+    v[0] ^= xtea_getu32(&data[i]);
+    v[1] ^= xtea_getu32(&data[i + 4]);
+    xtea_encipher(v, k);
+  }
+  return v[0];
+}
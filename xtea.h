@@ -0,0 +1,17 @@
+/* $Id: xtea.h $
+ * XTEA, used to authenticate over-the-air config updates (see ota.h).
+ * This is shared between the sensor firmware and the host tools.
+ */
+
+#ifndef _XTEA_H_
+#define _XTEA_H_
+
+/* Encrypts one 64 bit block v with the 128 bit key k, 32 rounds. */
+void xtea_encipher(uint32_t * v, uint32_t * k);
+
+/* Calculates a CBC-MAC over len bytes of data (len has to be a multiple
+ * of 8) with the 16 byte key, and returns its first 4 bytes (MSB first).
+ * Only safe for messages of a fixed length. */
+uint32_t xtea_cbcmac(uint8_t * data, uint8_t len, uint8_t * key);
+
+#endif /* _XTEA_H_ */